@@ -1,12 +1,17 @@
 #!/usr/bin/env python
 from __future__ import with_statement
 
+import os
 import sys
+import time
+import Queue
 import StringIO
+import threading
+import contextlib
 
 import _PyV8
 
-__all__ = ["JSError", "JSArray", "JSClass", "JSEngine", "JSContext", "debugger"]
+__all__ = ["JSError", "JSArray", "JSMapping", "JSClass", "JSEngine", "JSContext", "JSExtension", "JSErrorPolicy", "JSContextPool", "JSLocker", "JSUnlocker", "JSEnginePool", "JSTimeoutError", "register_converter", "to_py", "debugger"]
 
 class JSError(Exception):
     def __init__(self, impl):
@@ -28,6 +33,14 @@ class JSError(Exception):
 _PyV8._JSError._jsclass = JSError
 
 JSArray = _PyV8.JSArray
+JSMapping = _PyV8.JSMapping
+JSExtension = _PyV8.JSExtension
+JSErrorPolicy = _PyV8.JSErrorPolicy
+JSEnginePool = _PyV8.JSEnginePool
+JSTimeoutError = _PyV8.JSTimeoutError
+
+register_converter = _PyV8.register_converter
+to_py = _PyV8.to_py
 
 class JSClass(object):    
     def toString(self):
@@ -392,6 +405,124 @@ class JSContext(_PyV8.JSContext):
         
         del self
 
+class JSLocker(_PyV8.JSLocker):
+    def __enter__(self):
+        self.enter()
+        
+        return self
+    
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.leave()
+        
+class JSUnlocker(_PyV8.JSUnlocker):
+    def __enter__(self):
+        self.enter()
+        
+        return self
+    
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.leave()
+
+class JSContextPool(object):
+    """A pool of pre-created contexts.
+    
+    The contexts are handed out by acquire() and never reused, scripts can change
+    the builtins or define globals that can't be deleted, so a released context is
+    dropped and replaced with a fresh one.
+    
+    With background, the fresh contexts are created by another thread, which turns
+    on the V8 locking for the whole process, so every thread must hold a JSLocker
+    to use V8, and it has to be turned on already."""
+    
+    def __init__(self, size=4, factory=JSContext, background=False):
+        if background and not JSLocker.active:
+            raise RuntimeError("the background refill needs every thread to hold JSLocker")
+            
+        self.size = size
+        self.factory = factory
+        self.background = background
+        
+        self.acquired = 0
+        self.waits = 0
+        self.waitTime = 0.0
+        self.discards = 0
+        
+        self._idle = Queue.Queue()
+        self._leased = set()
+        self._lock = threading.Lock()
+        
+        for i in xrange(size):
+            self._idle.put(self._create())
+            
+    def _create(self):
+        if JSLocker.active and not JSLocker.locked:
+            with JSLocker():
+                return self.factory()
+            
+        return self.factory()
+        
+    def _refill(self):
+        # V8 must be locked as soon as a second thread uses it
+        with JSLocker():
+            self._idle.put(self.factory())
+    
+    @property
+    def idle(self):
+        "Returns the number of contexts ready to be acquired."
+        return self._idle.qsize()
+    
+    @property
+    def avgWaitTime(self):
+        return self.waitTime / self.acquired if self.acquired else 0.0
+        
+    def acquire(self, timeout=None):
+        "Returns an idle context, waiting up to timeout seconds for one, or raises Queue.Empty."
+        start = time.time()
+        
+        try:
+            ctxt = self._idle.get(False)
+        except Queue.Empty:
+            if JSLocker.locked:
+                # let the background threads refill the pool
+                with JSUnlocker():
+                    ctxt = self._idle.get(True, timeout)
+            else:
+                ctxt = self._idle.get(True, timeout)
+            
+            with self._lock:
+                self.waits += 1
+            
+        with self._lock:
+            self.acquired += 1
+            self.waitTime += time.time() - start
+            self._leased.add(id(ctxt))
+        
+        return ctxt
+    
+    def release(self, ctxt):
+        "Returns the context to the pool, which replaces it with a fresh one."
+        with self._lock:
+            self._leased.remove(id(ctxt))
+            
+            self.discards += 1
+        
+        if self.background:
+            refill = threading.Thread(target=self._refill)
+            refill.setDaemon(True)
+            refill.start()
+        else:
+            self._idle.put(self._create())
+            
+    @contextlib.contextmanager
+    def context(self, timeout=None):
+        "Acquire a context for the with statement and release it afterwards."
+        ctxt = self.acquire(timeout)
+        
+        try:
+            yield ctxt
+        finally:
+            self.release(ctxt)
+
 import unittest
 import logging
 import traceback
@@ -428,6 +559,23 @@ class TestContext(unittest.TestCase):
         self.assert_(not bool(JSContext.entered))
         self.assert_(not bool(JSContext.inContext))
         
+    def testExtension(self):
+        ext = JSExtension("hello/javascript", "function hello(name) { return 'hello ' + name; }")
+
+        self.assertEquals("hello/javascript", ext.name)
+        self.assertEquals([], ext.dependencies)
+        self.assertFalse(ext.autoEnable)
+
+        JSExtension("greet/javascript", "function greet() { return hello('world'); }", ["hello/javascript"])
+
+        self.assertRaises(ValueError, JSExtension, "hello/javascript", "")
+
+        with JSContext(extensions=["greet/javascript"]) as ctxt:
+            self.assertEquals("hello world", str(ctxt.eval("greet()")))
+
+        with JSContext() as ctxt:
+            self.assertRaises(JSError, JSContext.eval, ctxt, "hello('world')")
+
     def _testMultiContext(self):
         # Create an environment
         with JSContext() as ctxt0:
@@ -515,6 +663,207 @@ class TestContext(unittest.TestCase):
             # Check that env1.prop still exists.
             self.assertEquals(3, int(env1.locals.prop))            
 
+class TestContextPool(unittest.TestCase):
+    def testFresh(self):
+        pool = JSContextPool(1, background=False)
+        
+        self.assertEquals(1, pool.idle)
+        
+        with pool.context() as ctxt:
+            self.assertEquals(0, pool.idle)
+            
+            ctxt.eval("x = 1; var y = 2; Array.prototype.leak = 3")
+            
+            self.assertEquals(1, ctxt.eval("x"))
+            
+        self.assertEquals(1, pool.idle)
+        self.assertEquals(1, pool.discards)
+        
+        with pool.context() as other:
+            self.assert_(other is not ctxt)
+            self.assertRaises(JSError, JSContext.eval, other, "x")
+            self.assertRaises(JSError, JSContext.eval, other, "y")
+            self.assertEquals(None, other.eval("[].leak"))
+            
+    def testBackground(self):
+        pool = JSContextPool(1, background=True)
+        
+        with pool.context() as ctxt:
+            ctxt.eval("var y = 1")
+            
+        with pool.context(timeout=10) as other:
+            self.assert_(other is not ctxt)
+            self.assertRaises(JSError, JSContext.eval, other, "y")
+            
+        self.assertEquals(2, pool.discards)
+        self.assertEquals(2, pool.acquired)
+        
+    def testUnlocked(self):
+        # the suite holds JSLocker, and V8 can't turn the locking off again
+        import subprocess
+        
+        script = """if True:
+            import PyV8
+            
+            pool = PyV8.JSContextPool(1)
+            
+            for i in range(3):
+                with pool.context() as ctxt:
+                    assert ctxt.eval("1 + 1") == 2
+                    
+            try:
+                PyV8.JSContextPool(1, background=True)
+            except RuntimeError:
+                pass
+            else:
+                raise AssertionError("background refill without locking")
+                
+            # no thread has locked V8, so the unlocked calls still work
+            assert not PyV8.JSLocker.active
+            
+            with PyV8.JSContext() as ctxt:
+                assert ctxt.eval("2 + 2") == 4
+            """
+            
+        self.assertEquals(0, subprocess.call([sys.executable, "-c", script], 
+                                             cwd=os.path.dirname(os.path.abspath(__file__))))
+        
+class TestMultithread(unittest.TestCase):
+    def testLocker(self):
+        with JSLocker() as outter_locker:
+            self.assert_(JSLocker.active)
+            self.assert_(JSLocker.locked)
+            
+            self.assert_(outter_locker.entered())
+            
+            with JSLocker() as inner_locker:
+                self.assert_(JSLocker.locked)
+                
+                self.assert_(outter_locker.entered())
+                self.assert_(inner_locker.entered())
+                
+                with JSUnlocker() as unlocker:
+                    self.assertFalse(JSLocker.locked)
+                    
+                    self.assert_(outter_locker.entered())
+                    self.assert_(inner_locker.entered())
+                    
+                self.assert_(JSLocker.locked)
+                
+    def testMultiPythonThread(self):
+        import time, threading
+        
+        class Global(JSClass):
+            count = 0
+            started = threading.Event()
+            finished = threading.Semaphore(0)
+            
+            def sleep(self, ms):
+                time.sleep(ms / 1000.0)
+                
+                self.count += 1
+        
+        g = Global()
+        
+        def run():
+            with JSLocker():
+                with JSContext(g) as ctxt:
+                    ctxt.eval("""
+                        started.wait();
+                        
+                        for (i=0; i<10; i++)
+                        {
+                            sleep(100);
+                        }
+                        
+                        finished.release();
+                    """)
+        
+        threading.Thread(target=run).start()
+        
+        now = time.time()
+        
+        self.assertEqual(0, g.count)
+        
+        with JSUnlocker():
+            g.started.set()
+            g.finished.acquire()
+        
+        self.assertEqual(10, g.count)
+        
+        self.assert_((time.time() - now) >= 1)
+        
+    def testUnlocked(self):
+        pool = JSEnginePool(1)
+        
+        try:
+            with JSUnlocker():
+                self.assertRaises(RuntimeError, JSContext)
+        finally:
+            pool.shutdown()
+            
+    def testUnlockedEntryPoints(self):
+        with JSContext() as ctxt:
+            with JSEngine() as engine:
+                script = engine.compile("1")
+                
+        holding = threading.Event()
+        done = threading.Event()
+        
+        def hold():
+            with JSLocker():
+                holding.set()
+                done.wait(10)
+                
+        with JSUnlocker():
+            t = threading.Thread(target=hold)
+            t.start()
+            
+            try:
+                holding.wait(10)
+                
+                self.assert_(holding.isSet())
+                
+                # another thread holds V8, these have to fail before touching it
+                self.assertRaises(RuntimeError, ctxt.eval, "1")
+                self.assertRaises(RuntimeError, ctxt.eval_many, ["1"])
+                self.assertRaises(RuntimeError, script.run)
+            finally:
+                done.set()
+                t.join()
+                
+    def testEnginePool(self):
+        pool = JSEnginePool(2)
+        
+        self.assertEquals(2, pool.size)
+        
+        futures = [pool.submit("(function (a, b) { return a + b; })", [i, i]) for i in range(8)]
+        
+        self.assertEquals([i * 2 for i in range(8)], [future.result(10) for future in futures])
+        
+        self.assertEquals({'a': [1, 'x', None]}, pool.submit("({a: [1, 'x', null]})").result(10))
+        self.assertEquals(None, pool.submit("var x = 1;").result(10))
+        
+        self.assertRaises(JSError, pool.submit("throw Error('boom')").result, 10)
+        self.assertRaises(JSError, pool.submit("1", [1]).result, 10)
+        self.assertRaises(JSTimeoutError, pool.submit("for (;;) {}", timeout=0.1).result, 10)
+        
+        pool.shutdown()
+        
+        self.assertRaises(RuntimeError, pool.submit, "1")
+        
+    def testEnginePoolLimits(self):
+        pool = JSEnginePool(1, heap_limit=16 * 1024 * 1024)
+        
+        future = pool.submit("(function () { var a = []; for (;;) a.push(new Array(1024)); })()")
+        
+        self.assertRaises(MemoryError, future.result, 60)
+        
+        # the worker survives
+        self.assertEquals(2, pool.submit("1 + 1").result(10))
+        
+        pool.shutdown()
+        
 class TestWrapper(unittest.TestCase):    
     def testConverter(self):
         with JSContext() as ctxt:
@@ -553,6 +902,91 @@ class TestWrapper(unittest.TestCase):
             self.assert_("var_s" in attrs)
             self.assert_("var_b" in attrs)
             
+    def testPythonConverter(self):
+        with JSContext() as ctxt:
+            vars = ctxt.locals
+            
+            vars.i = 2 ** 40
+            self.assertEquals(2 ** 40, ctxt.eval("i"))
+            
+            vars.s = "a\0b"
+            self.assertEquals(3, ctxt.eval("s.length"))
+            
+            vars.u = u"\U0001d11e"
+            self.assertEquals(2, ctxt.eval("u.length"))
+            
+            class Money(object):
+                def __init__(self, cents):
+                    self.cents = cents
+                    
+            register_converter(Money, lambda money: money.cents / 100.0)
+            
+            try:
+                vars.m = Money(150)
+                self.assertEquals(1.5, ctxt.eval("m"))
+            finally:
+                register_converter(Money, None)
+                
+            vars.m = Money(150)
+            self.assertEquals(150, ctxt.eval("m.cents"))
+            
+    def testLargeString(self):
+        with JSContext() as ctxt:
+            vars = ctxt.locals
+            
+            vars.s = "x" * 100000
+            self.assertEquals(100000, ctxt.eval("s.length"))
+            
+            vars.u = u"\u20ac" * 100000
+            self.assertEquals(100000, ctxt.eval("u.length"))
+            self.assertEquals(0x20ac, ctxt.eval("u.charCodeAt(99999)"))
+            
+            with JSEngine() as engine:
+                self.assertEquals(100000, engine.compile("'%s'.length" % ("x" * 100000)).run())
+                self.assertEquals(3, engine.compile(u"'\u20ac\u20ac\u20ac'.length").run())
+            
+    def testBuffer(self):
+        with JSContext() as ctxt:
+            data = bytearray("abc" * 1000)
+            
+            ctxt.locals.data = data
+            
+            self.assertEqual(ord('a'), ctxt.eval("data[0]"))
+            self.assertEqual(ord('c'), ctxt.eval("data[2999]"))
+            
+            ctxt.eval("data[1] = 65; data[2] = 256 + 67")
+            
+            self.assertEqual("aAC", str(data[:3]))
+            
+            # the buffer stays exported while javascript holds it
+            self.assertRaises(BufferError, data.extend, "d")
+            
+            # until it is released explicitly
+            self.assert_(JSEngine.release_buffer(data))
+            self.failIf(JSEngine.release_buffer(data))
+            
+            data.extend("d")
+            
+            self.assertEqual(3001, len(data))
+            self.assert_(ctxt.eval("data[0] === undefined"))
+            
+            # and exported again when passed to javascript
+            ctxt.locals.data = data
+            
+            self.assertEqual(ord('d'), ctxt.eval("data[3000]"))
+            
+    def testStringResult(self):
+        with JSContext() as ctxt:
+            self.assertEquals(str, type(ctxt.eval("'hello' + ' world'")))
+            self.assertEquals("x" * 1000, ctxt.eval("new Array(1001).join('x')"))
+            
+            self.assertEquals(unicode, type(ctxt.eval("'\\u20ac'")))
+            self.assertEquals(u"caf\u00e9 \u20ac", ctxt.eval("'caf\\u00e9 \\u20ac'"))
+            self.assertEquals(u"\U0001d11e", ctxt.eval("'\\ud834\\udd1e'"))
+            
+            # ASCII content of a two-byte string is still returned as str
+            self.assertEquals(str, type(ctxt.eval("'\\u20acabc'.substring(1)")))
+            
     def testFunction(self):
         with JSContext() as ctxt:
             func = ctxt.eval("""
@@ -567,6 +1001,16 @@ class TestWrapper(unittest.TestCase):
                 };
                 """)
             self.assertEquals("abc", str(func()))
+            
+    def testFunctionResult(self):
+        with JSContext() as ctxt:
+            self.assertEquals(1, ctxt.eval("(function () { return 1; })")())
+            self.assertEquals(1.5, ctxt.eval("(function () { return 1.5; })")())
+            self.assertEquals("abc", ctxt.eval("(function () { return 'abc'; })")())
+            self.assertEquals(True, ctxt.eval("(function () { return true; })")())
+            self.assertEquals(None, ctxt.eval("(function () { return null; })")())
+            
+            self.assert_(isinstance(ctxt.eval("(function () { return 'abc'; })")(), str))
         
     def testJSError(self):
         with JSContext() as ctxt:
@@ -711,7 +1155,249 @@ class TestWrapper(unittest.TestCase):
                 """)
             
             self.assertEqual(165, ctxt.locals.sum)
-    
+            
+    def testToPython(self):
+        with JSContext() as ctxt:
+            obj = ctxt.eval("""
+                var shared = { name: 'shared' };
+                var obj = { n: 1, f: 2.5, s: 'abc', b: true, z: null, 
+                            a: [1, [2, 3], shared], o: { shared: shared }, 
+                            func: function () { return 42; } };
+                obj.self = obj;
+                obj;
+                """)
+            
+            result = to_py(obj)
+            
+            self.assertEqual(dict, type(result))
+            self.assertEqual(1, result['n'])
+            self.assertEqual(2.5, result['f'])
+            self.assertEqual("abc", result['s'])
+            self.assertEqual(True, result['b'])
+            self.assertEqual(None, result['z'])
+            self.assertEqual([1, [2, 3], {'name': 'shared'}], result['a'])
+            
+            self.assert_(result['self'] is result)
+            self.assert_(result['a'][2] is result['o']['shared'])
+            self.assertEqual(42, result['func']())
+            
+            shallow = to_py(obj, deep=False)
+            
+            self.assertEqual(dict, type(shallow))
+            self.assert_(isinstance(shallow['a'], _PyV8.JSArray))
+            
+            self.assert_(isinstance(to_py(obj, max_depth=2)['a'][1], _PyV8.JSArray))
+            
+            # many objects of the same shape, still converted once each
+            points = to_py(ctxt.eval("""
+                var points = [];
+                for (var i=0; i<100; i++) points.push({ x: i, y: i });
+                [points, points[50], points[99]];
+                """))
+                
+            self.assertEqual(100, len(points[0]))
+            self.assert_(points[1] is points[0][50])
+            self.assert_(points[2] is points[0][99])
+            
+    def testAttributes(self):
+        with JSContext() as ctxt:
+            obj = ctxt.eval("({ a: 1, u: undefined })")
+            
+            for i in xrange(3):
+                self.assertEqual(1, obj.a)
+                self.assertEqual(None, obj.u)
+                self.assertRaises(AttributeError, lambda: obj.missing)
+            
+            obj.b = 2
+            setattr(obj, "dynamic_%d" % 42, 3)
+            
+            self.assertEqual(5, ctxt.eval("(function (o) { return o.b + o.dynamic_42; })")([obj]))
+            
+            del obj.b
+            
+            self.assertRaises(AttributeError, lambda: obj.b)
+            
+    def testClassTemplate(self):
+        class Point(object):
+            __slots__ = ('x', 'y')
+            
+            dims = 2
+            
+            def __init__(self, x, y):
+                self.x = x
+                self.y = y
+                
+            @property
+            def norm(self):
+                return abs(self.x) + abs(self.y)
+            
+            def move(self, dx, dy):
+                return Point(self.x + dx, self.y + dy)
+            
+        class Named(Point):
+            __slots__ = ('__dict__', )
+            
+            def move(self, dx, dy):
+                return "moved"
+            
+            @property
+            def kind(self):
+                return "named"
+            
+        with JSContext() as ctxt:
+            ctxt.locals.p = Point(1, -2)
+            
+            self.assertEqual(1, ctxt.eval("p.x"))
+            self.assertEqual(3, ctxt.eval("p.norm"))
+            self.assertEqual(2, ctxt.eval("p.dims"))
+            self.assertEqual(5, ctxt.eval("p.move(1, 1).x + p.move(2, 2).norm"))
+            self.assertEqual("[object Point]", ctxt.eval("Object.prototype.toString.call(p)"))
+            self.assertEqual("function", ctxt.eval("typeof Object.getPrototypeOf(p).move"))
+            self.assertEqual("", ctxt.eval("Object.keys(p).join()"))
+            
+            ctxt.eval("p.x = 10")
+            
+            self.assertEqual(10, ctxt.locals.p.x)
+            
+            # the class members are looked up again, as the instance attributes
+            Point.dims = 3
+            
+            self.assertEqual(3, ctxt.eval("p.dims"))
+            
+            # the methods are shared by the instances, as the JS methods
+            self.assert_(ctxt.eval("p.move === p.move"))
+            self.assert_(ctxt.eval("p.move === Object.getPrototypeOf(p).move"))
+            
+            # and have to be bound explicitly when detached
+            self.assertRaises(JSError, ctxt.eval, "var move = p.move; move(1, 1)")
+            self.assertEqual(0, ctxt.eval("(function (callback) { return callback(2, 2).y; })(p.move.bind(p))"))
+            
+            n = Named(0, 0)
+            n.label = "origin"
+            
+            ctxt.locals.n = n
+            
+            self.assertEqual("moved", ctxt.eval("n.move(1, 1)"))
+            self.assertEqual("origin", ctxt.eval("n.label"))
+            
+            # the data descriptors win over the instance dict, as in Python
+            n.__dict__['kind'] = "shadowed"
+            
+            self.assertEqual("named", ctxt.eval("n.kind"))
+            
+            # the names aren't narrowed to ASCII
+            n.__dict__[u'caf\u00e9'] = 1
+            
+            self.assertEqual(1, ctxt.eval("n['caf\\u00e9']"))
+            
+            # the unset slots read as undefined
+            ctxt.locals.q = Point.__new__(Point)
+            
+            self.assert_(ctxt.eval("q.x === undefined"))
+            self.assert_(ctxt.eval("q.norm === undefined"))
+            
+            # the members added to the class later are only found for the instances with a dict
+            Point.added = "added"
+            
+            self.assertEqual("added", ctxt.eval("n.added"))
+            self.assert_(ctxt.eval("p.added === undefined"))
+            
+            n.move = lambda dx, dy: "patched"
+            n.extra = 42
+            
+            self.assertEqual("patched", ctxt.eval("n.move(1, 1)"))
+            self.assertEqual(42, ctxt.eval("n.extra"))
+            
+    def testPythonContainers(self):
+        with JSContext() as ctxt:
+            d = {'a': 1, 'b': 'two', 3: 'three'}
+            l = [1, 2, 3]
+            
+            ctxt.locals.d = d
+            ctxt.locals.l = l
+            ctxt.locals.t = (4, 5)
+            
+            self.assertEqual(1, ctxt.eval("d.a"))
+            self.assertEqual("three", ctxt.eval("d[3]"))
+            self.assertEqual(True, ctxt.eval("'b' in d"))
+            self.assertEqual(False, ctxt.eval("'c' in d"))
+            self.assertEqual("3,a,b", ctxt.eval("var keys = []; for (var k in d) keys.push(k); keys.sort().join()"))
+            self.assertEqual(2, ctxt.eval("d.get('z', 2)"))
+            
+            ctxt.eval("d.c = 4; delete d.a")
+            
+            self.assertEqual({'b': 'two', 'c': 4, 3: 'three'}, d)
+            
+            self.assertEqual(3, ctxt.eval("l.length"))
+            self.assertEqual(6, ctxt.eval("var s = 0; for (var i=0; i<l.length; i++) s += l[i]; s"))
+            self.assertEqual("0,1,2", ctxt.eval("var idx = []; for (var i in l) idx.push(i); idx.join()"))
+            
+            ctxt.eval("l[0] = 10; l[3] = 4")
+            
+            self.assertEqual([10, 2, 3, 4], l)
+            
+            self.assertEqual(2, ctxt.eval("t.length"))
+            self.assertEqual(5, ctxt.eval("t[1]"))
+            self.assertRaises(JSError, ctxt.eval, "t[0] = 1")
+            
+    def testMapping(self):
+        with JSContext() as ctxt:
+            obj = JSMapping(ctxt.eval("({ a: 1, b: 'two', c: null })"))
+            
+            self.assertEqual(3, len(obj))
+            self.assertEqual(['a', 'b', 'c'], list(obj))
+            self.assertEqual(['a', 'b', 'c'], obj.keys())
+            self.assertEqual([1, 'two', None], obj.values())
+            self.assertEqual([('a', 1), ('b', 'two'), ('c', None)], obj.items())
+            
+            self.assertEqual(1, obj['a'])
+            self.assertEqual(None, obj['c'])
+            self.assertRaises(KeyError, lambda: obj['d'])
+            
+            self.assert_('a' in obj)
+            self.assert_(u'b' in obj)
+            self.assertFalse('d' in obj)
+            self.assertFalse(1 in obj)
+            
+            big = JSMapping(ctxt.eval("var big = {}; for (var i=0; i<1000; i++) big['k' + i] = i; big"))
+            
+            self.assertEqual(range(1000), list(big.itervalues()))
+            self.assertEqual(dict(('k%d' % i, i) for i in range(1000)), dict(big.iteritems()))
+            
+            # the JS properties of the same names aren't shadowed by the mapping methods
+            obj = ctxt.eval("({ keys: 1, items: 2, to_py: 3 })")
+            
+            self.assertEqual(1, obj.keys)
+            self.assertEqual(2, obj.items)
+            self.assertEqual(3, obj.to_py)
+            
+            self.assertFalse(hasattr(ctxt.eval("(function () {})"), "__len__"))
+            
+    def testArrayBulk(self):
+        with JSContext() as ctxt:
+            ctxt.locals.numbers = JSArray.from_sequence(range(100000))
+            
+            self.assertEqual(100000, ctxt.eval("numbers.length"))
+            self.assertEqual(99999, ctxt.eval("numbers[99999]"))
+            
+            ctxt.locals.mixed = JSArray.from_sequence((1, 2.5, "abc", None, 2 ** 40))
+            
+            self.assertEqual("number,number,string,object,number", ctxt.eval("mixed.map(function (v) { return typeof v; }).join()"))
+            
+            array = ctxt.eval("[1, 2.5, 'abc', null, [3]]")
+            
+            items = array.to_list()
+            
+            self.assertEqual(list, type(items))
+            self.assertEqual([1, 2.5, "abc", None], items[:4])
+            self.assert_(isinstance(items[4], _PyV8.JSArray))
+            
+            self.assertEqual([1, 2.5], array[:2])
+            self.assertEqual([1, "abc"], array[::2][:2])
+            self.assertEqual([3], array[4].to_list())
+            
+            self.assertEqual(range(100000), ctxt.locals.numbers.to_list())
+            
 class TestEngine(unittest.TestCase):
     def testClassProperties(self):
         with JSContext() as ctxt:
@@ -727,10 +1413,160 @@ class TestEngine(unittest.TestCase):
                 self.assertEquals("1+2", s.source)
                 self.assertEquals(3, int(s.run()))
             
+    def testScriptCache(self):
+        cache = JSEngine.cache
+        cache.clear()
+
+        with JSContext() as ctxt:
+            with JSEngine() as engine:
+                s = engine.compile("1+2", "cached", 1, 1)
+
+                self.assertEquals(1, cache.misses)
+                self.assertEquals(s.source, engine.compile("1+2", "cached", 1, 1).source)
+                self.assertEquals(1, cache.hits)
+                self.assertEquals(1, cache.size)
+                self.assertEquals("cached", cache.scripts[0].name)
+
+                engine.compile("1+2", "other", 1, 1)
+
+                self.assertEquals(2, cache.size)
+
+                capacity = cache.capacity
+
+                try:
+                    cache.capacity = 1
+
+                    self.assertEquals(1, cache.size)
+                    self.assertEquals(1, cache.evictions)
+                    self.assertEquals("other", cache.scripts[0].name)
+                finally:
+                    cache.capacity = capacity
+
+                self.assertEquals(3, int(engine.compile("1+2", "other", 1, 1).run()))
+
+        cache.clear()
+
+        self.assertEquals(0, cache.size)
+        self.assertEquals(0, cache.hits)
+
+    def testPrecompile(self):
+        with JSContext() as ctxt:
+            with JSEngine() as engine:
+                data = JSEngine.precompile("function add(a, b) { return a+b; }; add(1, 2)")
+
+                self.assert_(data.startswith("PyV8 %s " % JSEngine.version))
+
+                s = engine.compile("function add(a, b) { return a+b; }; add(1, 2)", precompiled=data)
+
+                self.assertEquals(3, int(s.run()))
+                self.assertEquals(data, s.preparseData)
+
+                # stale preparse data is ignored
+                s = engine.compile("function add(a, b) { return a-b; }; add(1, 2)", precompiled=data)
+
+                self.assertEquals(-1, int(s.run()))
+
+                self.assertRaises(SyntaxError, JSEngine.precompile, "function (")
+
     def testEval(self):
         with JSContext() as ctxt:
             self.assertEquals(3, int(ctxt.eval("1+2")))        
             
+    def testEvalInContext(self):
+        with JSContext() as ctxt:
+            for i in xrange(3):
+                self.assertEquals(3, ctxt.eval("1+2"))
+
+            ctxt.eval("x = 1")
+
+            other = JSContext()
+
+            other.eval("x = 2")
+
+            self.assertEquals(1, ctxt.eval("x"))
+            self.assertEquals(2, other.eval("x"))
+
+            self.assertRaises(JSError, JSContext.eval, ctxt, "1+")
+
+            # more expressions than the cache holds evict the least recently used ones
+            for i in xrange(100):
+                self.assertEquals(3, ctxt.eval("1+2"))
+                self.assertEquals(i, ctxt.eval("%d" % i))
+
+    def testBatch(self):
+        with JSContext() as ctxt:
+            with JSEngine() as engine:
+                s = engine.compile("x = 1")
+
+                self.assertEquals([1, 2, 3], engine.run_many([s, "x + 1", "x + 2"]))
+
+            sources = ["1", "throw Error('test')", "3"]
+
+            self.assertRaises(JSError, ctxt.eval_many, sources)
+            self.assertEquals([1, None, 3], ctxt.eval_many(sources, JSErrorPolicy.Skip))
+
+            results = ctxt.eval_many(sources, policy=JSErrorPolicy.Collect)
+
+            self.assertEquals(1, results[0])
+            self.assert_(isinstance(results[1], JSError))
+            self.assertEquals("test", results[1].message)
+            self.assertEquals(3, results[2])
+
+    def testTimeout(self):
+        with JSContext() as ctxt:
+            now = time.time()
+            
+            self.assertRaises(JSTimeoutError, ctxt.eval, "while (true) {}", timeout=0.1)
+            
+            self.assert_((time.time() - now) < 5)
+            
+            # the context could run the next script
+            self.assertEquals(2, ctxt.eval("1 + 1", timeout=1))
+            
+            with JSEngine() as engine:
+                s = engine.compile("for (;;) {}")
+                
+                self.assertRaises(JSTimeoutError, s.run, 0.1)
+                
+    def testHeapStats(self):
+        stats = JSEngine.heap_stats()
+        
+        self.assert_(stats['used_heap_size'] > 0)
+        self.assert_(stats['total_heap_size'] >= stats['used_heap_size'])
+        self.assert_(stats['heap_size_limit'] > 0)
+        
+    def testHeapLimit(self):
+        self.assertEquals(0, JSEngine.heap_limit)
+        
+        JSEngine.heap_limit = 16 * 1024 * 1024
+        
+        try:
+            with JSContext() as ctxt:
+                f = ctxt.eval("(function () { var a = []; for (;;) a.push(new Array(1024)); })")
+                
+                self.assertRaises(MemoryError, f)
+                
+                # the next script starts with a clean state
+                self.assertEquals(2, ctxt.eval("1 + 1"))
+        finally:
+            JSEngine.heap_limit = 0
+            
+        JSEngine.collect()
+        
+    def testInterrupt(self):
+        if not hasattr(os, "kill"):
+            return
+            
+        import signal
+        
+        with JSContext() as ctxt:
+            for run in [lambda: ctxt.eval("while (true) {}"),
+                        lambda: ctxt.eval("while (true) {}", timeout=10),
+                        lambda: ctxt.eval_many(["1", "while (true) {}"])]:
+                threading.Timer(0.1, os.kill, (os.getpid(), signal.SIGINT)).start()
+                
+                self.assertRaises(KeyboardInterrupt, run)
+
     def testGlobal(self):
         class Global(JSClass):
             version = "1.0"
@@ -771,6 +1607,124 @@ class TestEngine(unittest.TestCase):
             
             self.assertFalse(ctxt.eval("this.hasOwnProperty(\"nonexistent\")"))
             
+    def testCallPython(self):
+        class Global(JSClass):
+            def add(self, *args):
+                return sum(args)
+                
+            def join(self, *args, **kwds):
+                return kwds.get('sep', ' ').join(args)
+                
+        with JSContext(Global()) as ctxt:
+            self.assertEquals(0, ctxt.eval("add()"))
+            self.assertEquals(36, ctxt.eval("add(1, 2, 3, 4, 5, 6, 7, 8)"))
+            
+            self.assertEquals("a b", ctxt.eval("join('a', 'b')"))
+            self.assertEquals("a,b", ctxt.eval("join('a', 'b', {__kwargs__: {sep: ','}})"))
+            
+    def testPythonIdentity(self):
+        def func():
+            pass
+            
+        with JSContext() as ctxt:
+            vars = ctxt.locals
+            
+            vars.f1 = func
+            vars.f2 = func
+            
+            self.assert_(ctxt.eval("f1 === f2"))
+            
+            obj = [1, 2, 3]
+            
+            vars.o1 = obj
+            vars.o2 = obj
+            vars.o3 = [1, 2, 3]
+            
+            self.assert_(ctxt.eval("o1 === o2"))
+            self.assertFalse(ctxt.eval("o1 === o3"))
+            
+    def testWrapperRelease(self):
+        import weakref
+        
+        class Foo(object):
+            pass
+            
+        with JSContext() as ctxt:
+            stats = JSEngine.wrapper_stats()
+            
+            foo = Foo()
+            ref = weakref.ref(foo)
+            
+            ctxt.locals.foo = foo
+            
+            self.assertEquals(stats['alive'] + 1, JSEngine.wrapper_stats()['alive'])
+            
+            del foo
+            ctxt.eval("foo = null")
+            
+            JSEngine.collect()
+            
+            self.assert_(ref() is None)
+            self.assert_(JSEngine.wrapper_stats()['released'] > stats['released'])
+            
+            # the template of the class doesn't keep it alive
+            import gc
+            
+            type_ref = weakref.ref(Foo)
+            
+            del Foo
+            gc.collect()
+            
+            self.assert_(type_ref() is None)
+            
+    def testCallableRelease(self):
+        import weakref
+        
+        class Foo(object):
+            def bar(self, i):
+                return i + 1
+                
+        foo = Foo()
+        ref = weakref.ref(foo)
+        
+        with JSContext() as ctxt:
+            # every access creates a new bound method, which is released after the call
+            for i in range(100):
+                ctxt.locals.bar = foo.bar
+                self.assertEquals(i + 1, ctxt.eval("bar(%d)" % i))
+                
+            ctxt.eval("bar = null")
+            
+            stats = JSEngine.wrapper_stats()
+            
+            del foo
+            JSEngine.collect()
+            
+            self.assert_(ref() is None)
+            self.assert_(JSEngine.wrapper_stats()['released'] > stats['released'])
+            
+            # a function comes back as itself
+            def func():
+                pass
+                
+            ctxt.locals.func = func
+            
+            self.assert_(ctxt.locals.func is func)
+            self.assertEquals(func, ctxt.eval("func"))
+            
+    def testJavascriptIdentity(self):
+        with JSContext() as ctxt:
+            ctxt.eval("var o = {a: [1, 2]}; function f() {}")
+            
+            vars = ctxt.locals
+            
+            self.assert_(vars.o is vars.o)
+            self.assert_(vars.o.a is vars.o.a)
+            self.assert_(vars.f is vars.f)
+            self.assert_(ctxt.locals is ctxt.locals)
+            
+            self.assert_(vars.o is not ctxt.eval("({a: [1, 2]})"))
+            
     def testPythonWrapper(self):
         class Global(JSClass):
             s = [1, 2, 3]
@@ -837,4 +1791,6 @@ if __name__ == '__main__':
     
     logging.info("testing PyV8 module with V8 v%s", JSEngine.version)
 
-    unittest.main()
\ No newline at end of file
+    # once any thread locks V8, every thread has to lock it before using V8
+    with JSLocker():
+        unittest.main()
\ No newline at end of file
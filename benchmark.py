@@ -0,0 +1,166 @@
+#!/usr/bin/env python
+"""Micro benchmarks of the marshalling between Python and javascript.
+
+usage: benchmark.py [-n times] [benchmark ...]
+"""
+from __future__ import with_statement
+
+import sys
+import time
+import getopt
+
+from PyV8 import *
+
+benchmarks = []
+
+def benchmark(func):
+    benchmarks.append(func)
+
+    return func
+
+def measure(name, times, func, *args):
+    start = time.time()
+
+    func(*args)
+
+    elapsed = time.time() - start
+
+    print "%-32s %10d %12.3f us" % (name, times, elapsed * 1000000 / times)
+
+VALUES = [
+    ("None", None),
+    ("bool", True),
+    ("int", 42),
+    ("long", 2 ** 40),
+    ("float", 3.14),
+    ("str", "hello world"),
+    ("unicode", u"hello world"),
+    ("list", [1, 2, 3]),
+    ("dict", {"a": 1}),
+    ("tuple", (1, 2, 3)),
+]
+
+@benchmark
+def to_js(times):
+    """Python -> javascript, setting a global variable per value."""
+
+    with JSContext() as ctxt:
+        glob = ctxt.locals
+
+        for name, value in VALUES:
+            def run():
+                for i in xrange(times):
+                    glob.value = value
+
+            measure("to_js." + name, times, run)
+
+@benchmark
+def callback(times):
+    """javascript -> Python -> javascript, a Python function returning its argument."""
+
+    class Global(JSClass):
+        def echo(self, value):
+            return value
+
+    with JSContext(Global()) as ctxt:
+        for name, source in [("int", "42"), ("float", "3.14"), ("str", "'hello world'")]:
+            loop = ctxt.eval("(function (n) { for (var i=0; i<n; i++) echo(%s); })" % source)
+
+            measure("callback." + name, times, loop, [times])
+
+@benchmark
+def call_js(times):
+    """Python -> javascript function calls, the results converted back to Python."""
+
+    with JSContext() as ctxt:
+        for name, source in [("int", "42"), ("float", "3.14"), ("str", "'hello world'"), ("object", "{}")]:
+            func = ctxt.eval("(function () { return %s; })" % source)
+
+            def run():
+                for i in xrange(times):
+                    func()
+
+            measure("call_js." + name, times, run)
+
+@benchmark
+def classes(times):
+    """javascript -> Python members, the generic interceptors against the class templates.
+
+    generic is the lookup before the class templates, a class with __getattr__ still
+    takes it. dict instances get the interceptor for their own attributes, slots
+    instances are read from the accessors and the prototype only.
+    """
+
+    class Slots(object):
+        __slots__ = ('x', )
+
+        def __init__(self):
+            self.x = 1
+
+        def get(self):
+            return self.x
+
+    class Dict(object):
+        def __init__(self):
+            self.x = 1
+
+        def get(self):
+            return self.x
+
+    class Generic(Dict):
+        def __getattr__(self, name):
+            raise AttributeError(name)
+
+    with JSContext() as ctxt:
+        attr = ctxt.eval("(function (obj, n) { for (var i=0; i<n; i++) obj.x; })")
+        method = ctxt.eval("(function (obj, n) { for (var i=0; i<n; i++) obj.get(); })")
+
+        for name, obj in [("generic", Generic()), ("dict", Dict()), ("slots", Slots())]:
+            measure("classes.%s.attr" % name, times, attr, [obj, times])
+            measure("classes.%s.method" % name, times, method, [obj, times])
+
+@benchmark
+def wrap(times):
+    """javascript -> Python objects, the cost of keying the wrapper cache by the identity hash.
+
+    fresh objects get their identity hash on the first wrap, hashed objects
+    already have it but their wrappers are gone, cached objects hit the cache.
+    """
+
+    with JSContext() as ctxt:
+        fresh = ctxt.eval("(function () { return {}; })")
+        hashed = ctxt.eval("""
+            var objs = [];
+            for (var i=0; i<1024; i++) objs.push({});
+            (function (i) { return objs[i & 1023]; })""")
+        cached = ctxt.eval("var obj = {}; (function () { return obj; })")
+
+        for i in xrange(1024):
+            hashed([i])
+
+        # the wrapper stays alive, so the calls hit the cache
+        keep = cached()
+
+        def run(func):
+            for i in xrange(times):
+                func(i)
+
+        measure("wrap.fresh", times, run, lambda i: fresh())
+        measure("wrap.hashed", times, run, lambda i: hashed([i]))
+        measure("wrap.cached", times, run, lambda i: cached())
+
+def main(argv):
+    times = 100000
+
+    opts, args = getopt.getopt(argv, "n:")
+
+    for opt, value in opts:
+        if opt == "-n":
+            times = int(value)
+
+    for func in benchmarks:
+        if not args or func.__name__ in args:
+            func(times)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
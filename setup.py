@@ -2,7 +2,7 @@
 import os, os.path
 from distutils.core import setup, Extension
 
-source_files = ["Exception.cpp", "Context.cpp", "Engine.cpp", "Wrapper.cpp", "Debug.cpp", "PyV8.cpp"]
+source_files = ["Exception.cpp", "Context.cpp", "Engine.cpp", "Wrapper.cpp", "Debug.cpp", "Locker.cpp", "Pool.cpp", "PyV8.cpp"]
 
 macros = [("BOOST_PYTHON_STATIC_LIB", None)]
 third_party_libraries = ["python", "boost", "v8"]
@@ -20,7 +20,7 @@ if os.name == "nt":
   extra_compile_args += ["/O2", "/GL", "/MT", "/EHsc", "/Gy", "/Zi"]
   extra_link_args += ["/DLL", "/OPT:REF", "/OPT:ICF", "/MACHINE:X86"]
 elif os.name == "posix":
-  libraries = ["boost_python", "v8", "rt"]
+  libraries = ["boost_python", "boost_thread", "boost_chrono", "v8", "rt"]
 
 pyv8 = Extension(name = "_PyV8",
                  sources = [os.path.join("src", file) for file in source_files],                 
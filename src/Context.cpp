@@ -3,11 +3,59 @@
 #include "Wrapper.h"
 #include "Engine.h"
 
+#include <map>
+
+struct CExtensionData
+{
+  std::string m_name, m_source;
+  std::vector<std::string> m_deps;
+  std::vector<const char *> m_dep_names;
+
+  CExtensionData(const std::string& name, const std::string& source, 
+                 const std::vector<std::string>& deps)
+    : m_name(name), m_source(source), m_deps(deps)
+  {
+    for (size_t i=0; i<m_deps.size(); i++) m_dep_names.push_back(m_deps[i].c_str());
+  }
+};
+
+class CScriptExtension : public CExtensionData, public v8::Extension
+{
+public:
+  // v8::Extension only keeps the pointers, CExtensionData is initialized 
+  // first and owns the strings for the lifetime of the extension
+
+  CScriptExtension(const std::string& name, const std::string& source, 
+                   const std::vector<std::string>& deps)
+    : CExtensionData(name, source, deps), 
+      v8::Extension(m_name.c_str(), m_source.c_str(), m_dep_names.size(), 
+                    m_dep_names.empty() ? NULL : &m_dep_names[0], m_source.size())
+  {
+  }
+};
+
 void CContext::Expose(void)
 {
+  py::class_<CExtension, boost::noncopyable>("JSExtension", py::no_init)
+    .def(py::init<const std::string&, const std::string&, py::list, bool>(
+         (py::arg("name"), py::arg("source"), 
+          py::arg("dependencies") = py::list(), 
+          py::arg("autoEnable") = false),
+         "Register a javascript extension, V8 compiles it once and "
+         "installs it into every context created with it."))
+
+    .add_property("name", &CExtension::GetName)
+    .add_property("source", &CExtension::GetSource)
+    .add_property("dependencies", &CExtension::GetDependencies)
+    .add_property("autoEnable", &CExtension::IsAutoEnable, &CExtension::SetAutoEnable,
+                  "Install the extension into every new context.")
+    ;
+
   py::class_<CContext, boost::noncopyable>("JSContext", py::no_init)
-    .def(py::init<py::object>(py::arg("global") = py::object(), 
-                              "create a new context base on global object"))
+    .def(py::init<py::object, py::list>((py::arg("global") = py::object(), 
+                                         py::arg("extensions") = py::list()),
+                              "create a new context base on global object, "
+                              "with the named extensions installed"))
                   
     .add_property("securityToken", &CContext::GetSecurityToken, &CContext::SetSecurityToken)
 
@@ -20,7 +68,11 @@ void CContext::Expose(void)
     .add_static_property("inContext", &CContext::InContext,
                          "Returns true if V8 has a current context.")
 
-    .def("eval", &CContext::Evaluate)
+    .def("eval", &CContext::Evaluate, (py::arg("source"), py::arg("timeout") = 0.0),
+         "Evaluate the source, terminating it with JSTimeoutError after timeout seconds, 0 for no limit.")
+    .def("eval_many", &CContext::EvaluateMany, 
+         (py::arg("sources"), py::arg("policy") = StopOnError),
+         "Evaluate the sources in one pass and return the list of their results.")
 
     .def("enter", &CContext::Enter, "Enter this context. "
          "After entering a context, all code compiled and "
@@ -37,6 +89,50 @@ void CContext::Expose(void)
     py::objects::pointer_holder<boost::shared_ptr<CContext>,CContext> > >();
 }
 
+CExtension::CExtension(const std::string& name, const std::string& source, 
+                       py::list deps, bool autoEnable)
+{
+  typedef std::map<std::string, v8::Extension *> Extensions;
+
+  static Extensions s_extensions;
+
+  if (s_extensions.find(name) != s_extensions.end())
+    throw CJavascriptException("extension '" + name + "' has been registered", ::PyExc_ValueError);
+
+  std::vector<std::string> dep_names;
+
+  for (Py_ssize_t i=0; i < ::PyList_Size(deps.ptr()); i++)
+  {
+    dep_names.push_back(py::extract<const std::string>(deps[i])());
+  }
+
+  m_extension = new CScriptExtension(name, source, dep_names);
+  m_extension->set_auto_enable(autoEnable);
+
+  v8::RegisterExtension(m_extension);
+
+  s_extensions[name] = m_extension;
+}
+
+const std::string CExtension::GetSource(void) const
+{
+  return static_cast<CScriptExtension *>(m_extension)->m_source;
+}
+
+py::list CExtension::GetDependencies(void)
+{
+  py::list deps;
+
+  const std::vector<std::string>& names = static_cast<CScriptExtension *>(m_extension)->m_deps;
+
+  for (size_t i=0; i<names.size(); i++)
+  {
+    deps.append(names[i]);
+  }
+
+  return deps;
+}
+
 CContext::CContext(v8::Handle<v8::Context> context)
 {
   v8::HandleScope handle_scope;
@@ -44,11 +140,31 @@ CContext::CContext(v8::Handle<v8::Context> context)
   m_context = v8::Persistent<v8::Context>::New(context);
 }
 
-CContext::CContext(py::object global)
+CContext::CContext(py::object global, py::list extensions)
 {
+  CLocker::CheckLocked();
+
   v8::HandleScope handle_scope;
 
-  m_context = v8::Context::New();
+  std::vector<std::string> ext_names;
+  std::vector<const char *> ext_ptrs;
+
+  for (Py_ssize_t i=0; i < ::PyList_Size(extensions.ptr()); i++)
+  {
+    ext_names.push_back(py::extract<const std::string>(extensions[i])());
+  }
+
+  for (size_t i=0; i<ext_names.size(); i++)
+  {
+    ext_ptrs.push_back(ext_names[i].c_str());
+  }
+
+  v8::ExtensionConfiguration ext_config(ext_ptrs.size(), ext_ptrs.empty() ? NULL : &ext_ptrs[0]);
+
+  m_context = v8::Context::New(&ext_config);
+
+  if (m_context.IsEmpty())
+    throw CJavascriptException("fail to create the context or install its extensions");
 
   v8::Context::Scope context_scope(m_context);
 
@@ -110,11 +226,75 @@ CContextPtr CContext::GetCurrent(void)
   return CContextPtr(new CContext(v8::Context::GetCurrent())); 
 }
 
-py::object CContext::Evaluate(const std::string& src) 
+v8::Handle<v8::Script> CContext::GetScript(const std::string& src)
+{
+  ScriptCache::iterator it = m_scripts.find(src);
+
+  if (it != m_scripts.end()) 
+  {
+    m_order.splice(m_order.begin(), m_order, it->second.second);
+
+    return it->second.first;
+  }
+
+  v8::Handle<v8::Script> script = v8::Script::Compile(v8::String::New(src.c_str(), src.size()));
+
+  if (script.IsEmpty()) return script;
+
+  // a full cache drops the least recently used expression, so a large working set 
+  // doesn't flush the hot ones
+
+  if (m_scripts.size() >= MAX_CACHED_SCRIPTS) 
+  {
+    ScriptCache::iterator last = m_scripts.find(m_order.back());
+
+    last->second.first.Dispose();
+
+    m_scripts.erase(last);
+    m_order.pop_back();
+  }
+
+  m_order.push_front(src);
+  m_scripts[src] = std::make_pair(v8::Persistent<v8::Script>::New(script), m_order.begin());
+
+  return script;
+}
+
+void CContext::ClearScripts(void)
+{
+  for (ScriptCache::iterator it = m_scripts.begin(); it != m_scripts.end(); it++)
+  {
+    it->second.first.Dispose();
+  }
+
+  m_scripts.clear();
+  m_order.clear();
+}
+
+py::object CContext::Evaluate(const std::string& src, double timeout) 
 { 
-  CEngine engine;
+  CLocker::CheckLocked();
+
+  v8::HandleScope handle_scope;
+
+  v8::Context::Scope context_scope(m_context);
 
-  CScriptPtr script = engine.Compile(src);
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Script> script = GetScript(src);
+
+  if (script.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+
+  return CEngine::ExecuteScript(script, timeout); 
+}
+
+py::list CContext::EvaluateMany(py::list sources, ErrorPolicy policy)
+{
+  CLocker::CheckLocked();
+
+  v8::HandleScope handle_scope;
+
+  v8::Context::Scope context_scope(m_context);
 
-  return script->Run(); 
+  return CEngine::ExecuteMany(sources, policy, this);
 }
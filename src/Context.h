@@ -1,25 +1,57 @@
 #pragma once
 
 #include <cassert>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
 
 #include <boost/shared_ptr.hpp>
 
 #include "Wrapper.h"
+#include "Locker.h"
 
 class CContext;
 
 typedef boost::shared_ptr<CContext> CContextPtr;
 
+class CExtension
+{
+  v8::Extension *m_extension; // registered to and owned by V8
+public:
+  CExtension(const std::string& name, const std::string& source, 
+             py::list deps, bool autoEnable);
+
+  const std::string GetName(void) const { return m_extension->name(); }
+  const std::string GetSource(void) const;
+  py::list GetDependencies(void);
+
+  bool IsAutoEnable(void) { return m_extension->auto_enable(); }
+  void SetAutoEnable(bool value) { m_extension->set_auto_enable(value); }
+};
+
 class CContext 
 {
+  typedef std::list<std::string> ScriptOrder; // most recently used first
+  typedef std::map<std::string, std::pair<v8::Persistent<v8::Script>, ScriptOrder::iterator> > ScriptCache;
+
+  static const size_t MAX_CACHED_SCRIPTS = 64;
+
   v8::Persistent<v8::Context> m_context;
+
+  ScriptCache m_scripts;
+  ScriptOrder m_order;
+
+  void ClearScripts(void);
 public:
   CContext(v8::Handle<v8::Context> context);
 
-  CContext(py::object global);
+  CContext(py::object global, py::list extensions);
 
   ~CContext()
   {
+    ClearScripts();
+
     m_context.Dispose();
   }  
 
@@ -31,10 +63,13 @@ public:
   void SetSecurityToken(py::str token);
 
   bool IsEntered(void) { return !m_context.IsEmpty(); }
-  void Enter(void) { m_context->Enter(); }
+  void Enter(void) { CLocker::CheckLocked(); m_context->Enter(); }
   void Leave(void) { m_context->Exit(); }
 
-  py::object Evaluate(const std::string& src);
+  py::object Evaluate(const std::string& src, double timeout);
+  py::list EvaluateMany(py::list sources, ErrorPolicy policy);
+
+  v8::Handle<v8::Script> GetScript(const std::string& src);
 
   static CContextPtr GetEntered(void);
   static CContextPtr GetCurrent(void);
@@ -1,5 +1,6 @@
 #include "Debug.h"
 #include "irri_fix.h"
+#include "Locker.h"
 
 #include <sstream>
 #include <string>
@@ -43,6 +44,8 @@ void CDebug::OnDebugEvent(v8::DebugEvent event, v8::Handle<v8::Object> exec_stat
 {
   v8::HandleScope scope;
   
+  CPythonGIL python_gil;
+
   CDebug *pThis = static_cast<CDebug *>(v8::Handle<v8::External>::Cast(data)->Value());
 
   if (!pThis->m_enabled) return;
@@ -58,6 +61,8 @@ void CDebug::OnDebugEvent(v8::DebugEvent event, v8::Handle<v8::Object> exec_stat
 
 void CDebug::OnDebugMessage(const uint16_t* message, int length, void* data)
 {
+  CPythonGIL python_gil;
+
   CDebug *pThis = static_cast<CDebug *>(data);
 
   if (!pThis->m_enabled) return;
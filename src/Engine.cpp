@@ -1,4 +1,10 @@
 #include "Engine.h"
+#include "Locker.h"
+
+#include <csignal>
+#include <sstream>
+
+#include <boost/scoped_ptr.hpp>
 
 void CEngine::Expose(void)
 {
@@ -6,21 +12,77 @@ void CEngine::Expose(void)
   v8::V8::SetFatalErrorHandler(ReportFatalError);
   v8::V8::AddMessageListener(ReportMessage);
 
+  CWatchdog::Expose();
+
   py::class_<CEngine, boost::noncopyable>("JSEngine", py::init<>())
     .add_static_property("version", &CEngine::GetVersion)
 
+    // the limits in bytes of the scripts run by all the engines of the process, 0 for no limit
+
+    .add_static_property("heap_limit", &CResourceLimits::GetHeapLimit, &CResourceLimits::SetHeapLimit)
+    .add_static_property("stack_limit", &CResourceLimits::GetStackLimit, &CResourceLimits::SetStackLimit)
+
+    .def("heap_stats", &CResourceLimits::GetHeapStatistics, 
+         "Returns the heap statistics of the isolate as a dict.")
+    .staticmethod("heap_stats")
+    .def("wrapper_stats", &CPythonObject::GetWrapperStatistics,
+         "Returns the number of alive and released JS wrappers of Python objects as a dict.")
+    .staticmethod("wrapper_stats")
+    .def("release_buffer", &CPythonObject::ReleaseBuffer, (py::arg("obj")),
+         "Release the buffer exported to javascript, which then sees an empty array, "
+         "so Python could resize it again. Returns False if the buffer isn't exported.")
+    .staticmethod("release_buffer")
+    .def("collect", &CEngine::CollectAllGarbage, (py::arg("force") = true),
+         "Collect the garbage, a forced collection also runs the weak callbacks.")
+    .staticmethod("collect")
+
     .def("compile", &CEngine::Compile, (py::arg("source"), 
                                         py::arg("name") = std::string(),
                                         py::arg("line") = -1,
-                                        py::arg("col") = -1))    
+                                        py::arg("col") = -1,
+                                        py::arg("precompiled") = py::object()),
+         "Compile the source, reusing the preparse data from JSEngine.precompile "
+         "or JSScript.preparseData if it still matches the source and V8 version.")    
+
+    .def("run_many", &CEngine::RunMany, (py::arg("scripts"), py::arg("policy") = StopOnError),
+         "Run the compiled scripts or sources in one pass and return the list of their results.")
+
+    .def("precompile", &CEngine::Precompile, (py::arg("source")),
+         "Preparse the source and return the serialized preparse data.")
+    .staticmethod("precompile")
+
+    .add_static_property("cache", py::make_function(&CScriptCache::GetInstance, 
+                         py::return_value_policy<py::reference_existing_object>()),
+                         "The compiled script cache shared by all engines.")
     ;
 
   py::class_<CScript, boost::noncopyable>("JSScript", py::no_init)
     .add_property("source", &CScript::GetSource)
+    .add_property("name", &CScript::GetName)
+    .add_property("line", &CScript::GetLine)
+    .add_property("col", &CScript::GetColumn)
+    .add_property("preparseData", &CScript::GetPreparseData,
+                  "The serialized preparse data, to be passed back to JSEngine.compile.")
 
-    .def("run", &CScript::Run)
+    .def("run", &CScript::Run, (py::arg("timeout") = 0.0),
+         "Run the script, terminating it with JSTimeoutError after timeout seconds, 0 for no limit.")
     ;
 
+  py::class_<CScriptCache, boost::noncopyable>("JSScriptCache", py::no_init)
+    .add_property("capacity", &CScriptCache::GetCapacity, &CScriptCache::SetCapacity,
+                  "The maximum number of cached scripts, 0 to disable the cache.")
+    .add_property("size", &CScriptCache::GetSize)
+    .add_property("hits", &CScriptCache::GetHits)
+    .add_property("misses", &CScriptCache::GetMisses)
+    .add_property("evictions", &CScriptCache::GetEvictions)
+    .add_property("scripts", &CScriptCache::GetScripts, 
+                  "The cached scripts, most recently used first.")
+
+    .def("clear", &CScriptCache::Clear, "Drop all the cached scripts and reset the counters.")
+    ;
+
+  py::import("atexit").attr("register")(py::make_function(&CScriptCache::Shutdown));
+
   py::objects::class_value_wrapper<boost::shared_ptr<CScript>, 
     py::objects::make_ptr_instance<CScript, 
     py::objects::pointer_holder<boost::shared_ptr<CScript>,CScript> > >();
@@ -48,49 +110,160 @@ void CEngine::ReportMessage(v8::Handle<v8::Message> message, v8::Handle<v8::Valu
   throw CJavascriptException(oss.str());
 }
 
-boost::shared_ptr<CScript> CEngine::Compile(const std::string& src, 
+void CEngine::CollectAllGarbage(bool force)
+{
+  if (force)
+  {
+    v8::V8::LowMemoryNotification();
+  }
+  else
+  {
+    while (!v8::V8::IdleNotification()) {}
+  }
+}
+
+uint64_t CEngine::HashSource(const std::string& src)
+{
+  // 64-bit FNV-1a, stable across processes and platforms
+
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (std::string::const_iterator it = src.begin(); it != src.end(); it++)
+  {
+    hash ^= static_cast<unsigned char>(*it);
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+const std::string CEngine::GetPreparseHeader(uint64_t hash)
+{
+  std::ostringstream oss;
+
+  oss << "PyV8 " << GetVersion() << " " << std::hex << hash << "\n";
+
+  return oss.str();
+}
+
+py::str CEngine::Precompile(const std::string& src)
+{
+  v8::HandleScope handle_scope;
+
+  boost::scoped_ptr<v8::ScriptData> data(v8::ScriptData::PreCompile(src.c_str(), src.size()));
+
+  if (data->HasError())
+    throw CJavascriptException("fail to preparse the script", ::PyExc_SyntaxError);
+
+  std::string buf = GetPreparseHeader(HashSource(src));
+
+  buf.append(data->Data(), data->Length());
+
+  return py::str(buf.c_str(), buf.size());
+}
+
+boost::shared_ptr<CScript> CEngine::Compile(py::object source, 
                                             const std::string name,
-                                            int line, int col)
+                                            int line, int col,
+                                            py::object precompiled)
 {
+  CLocker::CheckLocked();
+
   assert(v8::Context::InContext());
 
+  std::string src;
+
+  if (PyString_Check(source.ptr()))
+  {
+    src.assign(PyString_AS_STRING(source.ptr()), PyString_GET_SIZE(source.ptr()));
+  }
+  else if (PyUnicode_Check(source.ptr()))
+  {
+    py::object utf8(py::handle<>(::PyUnicode_AsUTF8String(source.ptr())));
+
+    src.assign(PyString_AS_STRING(utf8.ptr()), PyString_GET_SIZE(utf8.ptr()));
+  }
+  else
+  {
+    throw CJavascriptException("expect a str or unicode source", ::PyExc_TypeError);
+  }
+
+  uint64_t hash = HashSource(src);
+
+  CScriptCache& cache = CScriptCache::GetInstance();
+
+  CScriptPtr cached = cache.Lookup(src, hash, name, line, col);
+
+  if (cached) return cached;
+
   v8::HandleScope handle_scope;
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::String> script_source = v8::String::New(src.c_str());
+  // shared with the Python string instead of copied, when it's large enough
+  v8::Handle<v8::String> script_source = CPythonObject::WrapString(source);
   v8::Handle<v8::Value> script_name = name.empty() ? v8::Undefined() : v8::String::New(name.c_str());
 
-  v8::Handle<v8::Script> script;
+  boost::scoped_ptr<v8::ScriptData> pre_data;
 
-  if (line >= 0 && col >= 0)
+  if (PyString_Check(precompiled.ptr()))
   {
-    v8::ScriptOrigin script_origin(script_name, v8::Integer::New(line), v8::Integer::New(col));
+    const char *buf = PyString_AS_STRING(precompiled.ptr());
+    size_t len = PyString_GET_SIZE(precompiled.ptr());
 
-    script = v8::Script::Compile(script_source, &script_origin);
-  }
-  else
-  {
-    script = v8::Script::Compile(script_source, script_name);
+    const std::string header = GetPreparseHeader(hash);
+
+    // stale data, from another source or another V8 build, is just ignored
+
+    if (len > header.size() && 0 == header.compare(0, header.size(), buf, header.size()))
+    {
+      pre_data.reset(v8::ScriptData::New(buf + header.size(), len - header.size()));
+    }
   }
 
+  v8::Handle<v8::Script> script;
+
+  v8::ScriptOrigin script_origin(script_name, 
+    v8::Integer::New(line >= 0 && col >= 0 ? line : 0), 
+    v8::Integer::New(line >= 0 && col >= 0 ? col : 0));
+
+  script = v8::Script::New(script_source, &script_origin, pre_data.get());
+
   if (script.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
 
-  return boost::shared_ptr<CScript>(new CScript(*this, src, script));
+  CScriptPtr compiled(new CScript(src, name, line, col, hash, script));
+
+  cache.Insert(compiled);
+
+  return compiled;
 }
 
-py::object CEngine::ExecuteScript(v8::Handle<v8::Script> script)
+py::object CEngine::ExecuteScript(v8::Handle<v8::Script> script, double timeout)
 {    
   assert(v8::Context::InContext());
 
+  CLocker::CheckLocked();
+
   v8::HandleScope handle_scope;
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::Value> result = script->Run();
+  v8::Handle<v8::Value> result;
+
+  CWatchdog watchdog(timeout);
+  CExecutionScope execution_scope;
+
+  {
+    CPythonAllowThreads python_threads;
+
+    result = script->Run();
+  }
 
   if (result.IsEmpty())
   {
+    watchdog.ThrowIf(try_catch);
+    CResourceLimits::ThrowIf(try_catch);
+
     if (try_catch.HasCaught()) CJavascriptException::ThrowIf(try_catch);
 
     result = v8::Null();
@@ -99,9 +272,537 @@ py::object CEngine::ExecuteScript(v8::Handle<v8::Script> script)
   return CJavascriptObject::Wrap(result);
 }
 
-py::object CScript::Run(void) 
+py::list CEngine::ExecuteMany(py::list items, ErrorPolicy policy, CContext *context)
+{
+  assert(v8::Context::InContext());
+
+  CLocker::CheckLocked();
+
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  py::list results;
+
+  CWatchdog watchdog(0);
+  CExecutionScope execution_scope;
+
+  for (Py_ssize_t i=0; i < ::PyList_Size(items.ptr()); i++)
+  {
+    py::object item = items[i];
+
+    v8::Handle<v8::Script> script;
+
+    py::extract<CScript&> script_extractor(item);
+    py::extract<const std::string> source_extractor(item);
+
+    if (script_extractor.check())
+    {
+      script = script_extractor().Handle();
+    }
+    else if (source_extractor.check())
+    {
+      const std::string src = source_extractor();
+
+      script = context ? context->GetScript(src) : 
+        v8::Script::Compile(v8::String::New(src.c_str(), src.size()));
+    }
+    else
+    {
+      throw CJavascriptException("expect a JSScript or a source string", ::PyExc_TypeError);
+    }
+
+    v8::Handle<v8::Value> result;
+
+    if (!script.IsEmpty()) 
+    {
+      CPythonAllowThreads python_threads;
+
+      result = script->Run();
+    }
+
+    if (try_catch.HasCaught())
+    {
+      watchdog.ThrowIf(try_catch);
+      CResourceLimits::ThrowIf(try_catch);
+
+      if (StopOnError == policy || !try_catch.CanContinue()) 
+        CJavascriptException::ThrowIf(try_catch);
+
+      try
+      {
+        CJavascriptException::ThrowIf(try_catch);
+      }
+      catch (const CJavascriptException& ex)
+      {
+        results.append(CollectErrors == policy ? ExceptionTranslator::Instantiate(ex) : py::object());
+      }
+
+      try_catch.Reset();
+    }
+    else
+    {
+      results.append(CJavascriptObject::Wrap(result));
+    }
+  }
+
+  return results;
+}
+
+py::object CScript::Run(double timeout) 
 { 
+  CLocker::CheckLocked();
+
   v8::HandleScope handle_scope;
 
-  return m_engine.ExecuteScript(m_script); 
+  return CEngine::ExecuteScript(m_script, timeout); 
+}
+
+static boost::mutex s_watchdog_mutex;
+static boost::condition_variable s_watchdog_cond;
+static boost::thread *s_watchdog_thread = NULL;
+static std::list<CWatchdog *> s_watchdogs;
+
+static boost::thread::id s_main_thread;
+static volatile sig_atomic_t s_signaled = 0;
+static void (*s_signal_handler)(int) = NULL;
+
+PyObject *CWatchdog::s_timeout_error = NULL;
+
+void CWatchdog::Expose(void)
+{
+  s_main_thread = boost::this_thread::get_id();
+
+  s_timeout_error = ::PyErr_NewException(const_cast<char *>("_PyV8.JSTimeoutError"), ::PyExc_RuntimeError, NULL);
+
+  py::scope().attr("JSTimeoutError") = py::handle<>(py::borrowed(s_timeout_error));
+}
+
+CWatchdog::CWatchdog(double timeout)
+  : m_isolate(v8::Isolate::GetCurrent()), m_timed(timeout > 0), m_interruptible(false), 
+    m_registered(false), m_fired(false), m_interrupted(false), m_handled(false)
+{
+  m_interruptible = boost::this_thread::get_id() == s_main_thread && InstallSignalHandler();
+
+  // the scripts of the other threads without timeout are not watched at all
+
+  if (!m_timed && !m_interruptible) return;
+
+  if (m_timed)
+    m_deadline = clock::now() + boost::chrono::microseconds(static_cast<int64_t>(timeout * 1000000));
+
+  boost::mutex::scoped_lock lock(s_watchdog_mutex);
+
+  if (!s_watchdog_thread) s_watchdog_thread = new boost::thread(&CWatchdog::Watch);
+
+  if (m_interruptible && s_watchdogs.empty()) s_signaled = 0; // drop the SIGINT delivered between scripts
+
+  s_watchdogs.push_back(this);
+  m_registered = true;
+
+  s_watchdog_cond.notify_one();
+}
+
+CWatchdog::~CWatchdog()
+{
+  if (!m_registered) return;
+
+  bool pending;
+
+  {
+    boost::mutex::scoped_lock lock(s_watchdog_mutex);
+
+    s_watchdogs.remove(this);
+
+    pending = m_fired && !m_handled;
+  }
+
+  if (pending)
+  {
+    // the watchdog fired after the script finished, consume the termination 
+    // request before it hits the next script of this isolate
+
+    v8::HandleScope handle_scope;
+
+    v8::TryCatch try_catch;
+
+    v8::Handle<v8::Script> script = v8::Script::Compile(v8::String::New("void 0"));
+
+    if (!script.IsEmpty()) script->Run();
+  }
+}
+
+bool CWatchdog::InstallSignalHandler(void)
+{
+  // only called from the main thread, the handler stays installed and chains 
+  // to the original one, so the scripts don't swap it back and forth
+
+  static bool s_installed = false;
+
+  if (!s_installed)
+  {
+    s_installed = true;
+
+    SignalHandler handler = ::signal(SIGINT, OnSignal);
+
+    if (SIG_ERR == handler || SIG_IGN == handler || SIG_DFL == handler)
+    {
+      if (SIG_ERR != handler) ::signal(SIGINT, handler);
+    }
+    else
+    {
+      s_signal_handler = handler;
+    }
+  }
+
+  return s_signal_handler != NULL;
+}
+
+void CWatchdog::OnSignal(int signum)
+{
+  s_signaled = 1;
+
+  if (s_signal_handler) s_signal_handler(signum);
+
+  // some platforms reset the handler before calling it
+
+  ::signal(signum, OnSignal);
+}
+
+void CWatchdog::Watch(void)
+{
+  boost::mutex::scoped_lock lock(s_watchdog_mutex);
+
+  while (true)
+  {
+    clock::time_point now = clock::now(), wakeup = clock::time_point::max();
+
+    bool signaled = s_signaled != 0;
+
+    s_signaled = 0;
+
+    for (std::list<CWatchdog *>::iterator it = s_watchdogs.begin(); it != s_watchdogs.end(); it++)
+    {
+      CWatchdog *watchdog = *it;
+
+      if (watchdog->m_fired) continue;
+
+      if (watchdog->m_interruptible)
+      {
+        if (signaled)
+        {
+          watchdog->m_interrupted = true;
+        }
+        else
+        {
+          wakeup = std::min(wakeup, now + boost::chrono::milliseconds(POLL_INTERVAL_MS));
+        }
+      }
+
+      if (!watchdog->m_interrupted)
+      {
+        if (!watchdog->m_timed) continue;
+
+        if (watchdog->m_deadline > now)
+        {
+          wakeup = std::min(wakeup, watchdog->m_deadline);
+
+          continue;
+        }
+      }
+
+      watchdog->m_fired = true;
+
+      v8::V8::TerminateExecution(watchdog->m_isolate);
+    }
+
+    if (clock::time_point::max() == wakeup)
+      s_watchdog_cond.wait(lock);
+    else
+      s_watchdog_cond.wait_until(lock, wakeup);
+  }
+}
+
+bool CWatchdog::IsTerminated(v8::TryCatch& try_catch)
+{
+  if (!m_registered || !try_catch.HasCaught() || try_catch.CanContinue()) return false;
+
+  boost::mutex::scoped_lock lock(s_watchdog_mutex);
+
+  m_handled = true;
+
+  return m_fired;
+}
+
+void CWatchdog::ThrowIf(v8::TryCatch& try_catch)
+{
+  if (!IsTerminated(try_catch)) return;
+
+  if (m_interrupted)
+  {
+    // let the Python signal handler decide, it raises KeyboardInterrupt by default
+
+    if (::PyErr_CheckSignals() < 0) py::throw_error_already_set();
+
+    throw CJavascriptException("script execution interrupted", ::PyExc_KeyboardInterrupt);
+  }
+
+  throw CJavascriptException("script execution timed out", s_timeout_error);
+}
+
+CScriptPtr CScriptCache::Lookup(const std::string& src, uint64_t hash, 
+                                const std::string& name, int line, int col)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  if (0 == m_capacity) return CScriptPtr();
+
+  Index::iterator it = m_index.find(Key(hash, name, line, col));
+
+  if (it == m_index.end() || (*it->second)->GetSource() != src)
+  {
+    m_misses++;
+
+    return CScriptPtr();
+  }
+
+  m_hits++;
+
+  m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+  return m_entries.front();
+}
+
+void CScriptCache::Insert(CScriptPtr script)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  if (0 == m_capacity) return;
+
+  Key key(script->GetHash(), script->GetName(), script->GetLine(), script->GetColumn());
+
+  Index::iterator it = m_index.find(key);
+
+  if (it != m_index.end())
+  {
+    m_entries.erase(it->second);
+    m_index.erase(it);
+  }
+
+  Evict(m_capacity - 1);
+
+  m_entries.push_front(script);
+  m_index[key] = m_entries.begin();
+}
+
+void CScriptCache::Evict(size_t capacity)
+{
+  while (m_entries.size() > capacity)
+  {
+    CScriptPtr script = m_entries.back();
+
+    m_index.erase(Key(script->GetHash(), script->GetName(), script->GetLine(), script->GetColumn()));
+    m_entries.pop_back();
+
+    m_evictions++;
+  }
+}
+
+void CScriptCache::SetCapacity(size_t capacity)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  m_capacity = capacity;
+
+  Evict(capacity);
+}
+
+py::list CScriptCache::GetScripts(void) const
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  py::list scripts;
+
+  for (Entries::const_iterator it = m_entries.begin(); it != m_entries.end(); it++)
+  {
+    scripts.append(*it);
+  }
+
+  return scripts;
+}
+
+void CScriptCache::Clear(void)
+{
+  Entries entries;
+
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    // the scripts are released out of the lock
+    entries.swap(m_entries);
+
+    m_index.clear();
+
+    m_hits = m_misses = m_evictions = 0;
+  }
+}
+
+CResourceLimits *CResourceLimits::GetCurrent(bool create)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  CResourceLimits *limits = static_cast<CResourceLimits *>(isolate->GetData());
+
+  if (!limits && create)
+  {
+    limits = new CResourceLimits();
+
+    isolate->SetData(limits);
+
+    // the scavenges only free the young space, check the heap after the full GCs
+
+    v8::V8::AddGCEpilogueCallback(OnGarbageCollected, v8::kGCTypeMarkSweepCompact);
+  }
+
+  return limits;
+}
+
+void CResourceLimits::Release(void)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  CResourceLimits *limits = static_cast<CResourceLimits *>(isolate->GetData());
+
+  if (limits)
+  {
+    v8::V8::RemoveGCEpilogueCallback(OnGarbageCollected);
+
+    isolate->SetData(NULL);
+
+    delete limits;
+  }
+}
+
+bool CResourceLimits::SetHeapSize(size_t max_young_space_size, size_t max_old_space_size, size_t max_executable_size)
+{
+  v8::ResourceConstraints constraints;
+
+  constraints.set_max_young_space_size(static_cast<int>(max_young_space_size));
+  constraints.set_max_old_space_size(static_cast<int>(max_old_space_size));
+  constraints.set_max_executable_size(static_cast<int>(max_executable_size));
+
+  return v8::SetResourceConstraints(&constraints);
+}
+
+size_t CResourceLimits::GetStackLimit(void)
+{
+  CResourceLimits *limits = GetCurrent(false);
+
+  return limits ? limits->m_stack_limit : 0;
+}
+
+void CResourceLimits::SetStackLimit(size_t stack_limit)
+{
+  GetCurrent(true)->m_stack_limit = stack_limit;
+}
+
+size_t CResourceLimits::GetHeapLimit(void)
+{
+  CResourceLimits *limits = GetCurrent(false);
+
+  return limits ? limits->m_heap_limit : 0;
+}
+
+void CResourceLimits::SetHeapLimit(size_t heap_limit)
+{
+  GetCurrent(true)->m_heap_limit = heap_limit;
+}
+
+void CResourceLimits::OnGarbageCollected(v8::GCType type, v8::GCCallbackFlags flags)
+{
+  CResourceLimits *limits = GetCurrent(false);
+
+  // only terminate the scripts run by the engine, not the GCs of the embedder
+
+  if (!limits || !limits->m_heap_limit || !limits->m_depth) return;
+
+  v8::HeapStatistics stats;
+
+  v8::V8::GetHeapStatistics(&stats);
+
+  if (stats.used_heap_size() > limits->m_heap_limit)
+  {
+    limits->m_exceeded = true;
+
+    v8::V8::TerminateExecution(v8::Isolate::GetCurrent());
+  }
+}
+
+bool CResourceLimits::IsExceeded(v8::TryCatch& try_catch)
+{
+  if (!try_catch.HasCaught() || try_catch.CanContinue()) return false;
+
+  CResourceLimits *limits = GetCurrent(false);
+
+  if (!limits || !limits->m_exceeded) return false;
+
+  limits->m_exceeded = false;
+
+  return true;
+}
+
+void CResourceLimits::ThrowIf(v8::TryCatch& try_catch)
+{
+  if (IsExceeded(try_catch))
+    throw CJavascriptException("script execution exceeded the heap limit", ::PyExc_MemoryError);
+}
+
+CExecutionScope::CExecutionScope()
+  : m_limits(CResourceLimits::GetCurrent(false))
+{
+  if (!m_limits) return;
+
+  if (0 == m_limits->m_depth++)
+  {
+    // a new execution starts, forget the termination of the previous one
+
+    m_limits->m_exceeded = false;
+
+    if (m_limits->m_stack_limit)
+    {
+      // the limit is an address, counted from the current stack position of this thread
+
+      uint32_t here;
+
+      v8::ResourceConstraints constraints;
+
+      constraints.set_stack_limit(&here - m_limits->m_stack_limit / sizeof(uint32_t));
+
+      v8::SetResourceConstraints(&constraints);
+    }
+  }
+}
+
+CExecutionScope::~CExecutionScope()
+{
+  if (m_limits) m_limits->m_depth--;
+}
+
+py::dict CResourceLimits::GetHeapStatistics(void)
+{
+  v8::HeapStatistics stats;
+
+  v8::V8::GetHeapStatistics(&stats);
+
+  CResourceLimits *limits = GetCurrent(false);
+
+  py::dict result;
+
+  result["total_heap_size"] = stats.total_heap_size();
+  result["total_heap_size_executable"] = stats.total_heap_size_executable();
+  result["used_heap_size"] = stats.used_heap_size();
+  result["heap_size_limit"] = stats.heap_size_limit();
+  result["heap_limit"] = limits ? limits->m_heap_limit : 0;
+
+  return result;
 }
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <string>
+#include <list>
+#include <map>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/chrono.hpp>
 
 #include "Context.h"
 
@@ -10,34 +14,131 @@ class CScript;
 
 typedef boost::shared_ptr<CScript> CScriptPtr;
 
+// Terminates the script running in the current isolate when its deadline
+// passes, or on SIGINT when it runs on the main thread. The deadlines are
+// checked by a shared watchdog thread, V8 only polls the termination request.
+// A script without timeout is only watched for SIGINT on the main thread.
+
+class CWatchdog
+{
+  typedef void (*SignalHandler)(int);
+
+  static const int POLL_INTERVAL_MS = 100;
+
+  typedef boost::chrono::steady_clock clock;
+
+  v8::Isolate *m_isolate;
+  clock::time_point m_deadline;
+
+  bool m_timed, m_interruptible, m_registered;
+  bool m_fired, m_interrupted, m_handled;
+
+  static void Watch(void);
+  static void OnSignal(int signum);
+  static bool InstallSignalHandler(void);
+public:
+  CWatchdog(double timeout);
+  ~CWatchdog();
+
+  // whether the watchdog has terminated the script caught by try_catch
+  bool IsTerminated(v8::TryCatch& try_catch);
+
+  void ThrowIf(v8::TryCatch& try_catch);
+
+  static PyObject *s_timeout_error;
+
+  static void Expose(void);
+};
+
+// Resource limits of the current isolate. V8 only accepts the heap sizes
+// before the heap is set up, the soft heap limit is checked after every full
+// GC and terminates the running script with MemoryError instead of letting
+// V8 run out of memory. The stack limit is counted from the stack position
+// of the thread entering the outermost script.
+
+class CResourceLimits
+{
+  size_t m_heap_limit, m_stack_limit;
+  bool m_exceeded;
+  int m_depth;
+
+  static CResourceLimits *GetCurrent(bool create);
+
+  static void OnGarbageCollected(v8::GCType type, v8::GCCallbackFlags flags);
+
+  friend class CExecutionScope;
+public:
+  CResourceLimits() : m_heap_limit(0), m_stack_limit(0), m_exceeded(false), m_depth(0)
+  {
+  }
+
+  static bool SetHeapSize(size_t max_young_space_size, size_t max_old_space_size, size_t max_executable_size);
+  static size_t GetStackLimit(void);
+  static void SetStackLimit(size_t stack_limit);
+  static size_t GetHeapLimit(void);
+  static void SetHeapLimit(size_t heap_limit);
+  static void Release(void);
+
+  // whether the heap limit has terminated the script caught by try_catch
+  static bool IsExceeded(v8::TryCatch& try_catch);
+
+  static void ThrowIf(v8::TryCatch& try_catch);
+
+  static py::dict GetHeapStatistics(void);
+};
+
+// Marks the execution of an engine-owned script in the current isolate,
+// only those are terminated by the heap limit.
+
+class CExecutionScope
+{
+  CResourceLimits *m_limits;
+public:
+  CExecutionScope();
+  ~CExecutionScope();
+};
+
 class CEngine
 {  
 protected:
   static void ReportFatalError(const char* location, const char* message);
   static void ReportMessage(v8::Handle<v8::Message> message, v8::Handle<v8::Value> data);  
 public:
-  CScriptPtr Compile(const std::string& src, const std::string name = std::string(),
-                     int line = -1, int col = -1);
+  static uint64_t HashSource(const std::string& src);
+
+  CScriptPtr Compile(py::object source, const std::string name = std::string(),
+                     int line = -1, int col = -1, py::object precompiled = py::object());
   CJavascriptObjectPtr Execute(const std::string& src);
 
+  py::list RunMany(py::list scripts, ErrorPolicy policy) { return ExecuteMany(scripts, policy); }
+
   void RaiseError(v8::TryCatch& try_catch);
 public:  
   static void Expose(void);
 
   static const std::string GetVersion(void) { return v8::V8::GetVersion(); }
 
-  py::object ExecuteScript(v8::Handle<v8::Script> script);
+  static void CollectAllGarbage(bool force);
+
+  static py::str Precompile(const std::string& src);
+  static const std::string GetPreparseHeader(uint64_t hash);
+
+  static py::object ExecuteScript(v8::Handle<v8::Script> script, double timeout = 0);
+  static py::list ExecuteMany(py::list items, ErrorPolicy policy, CContext *context = NULL);
 };
 
 class CScript
 {
-  CEngine& m_engine;
   const std::string m_source;
+  const std::string m_name;
+  int m_line, m_col;
+  uint64_t m_hash;
 
   v8::Persistent<v8::Script> m_script;  
 public:
-  CScript(CEngine& engine, const std::string& source, v8::Handle<v8::Script> script) 
-    : m_engine(engine), m_source(source), 
+  CScript(const std::string& source, const std::string& name, int line, int col, 
+          uint64_t hash, v8::Handle<v8::Script> script) 
+    : m_source(source), m_name(name), m_line(line), m_col(col), m_hash(hash),
       m_script(v8::Persistent<v8::Script>::New(script))
   {
 
@@ -48,6 +149,83 @@ public:
   }
 
   const std::string GetSource(void) const { return m_source; }
+  const std::string GetName(void) const { return m_name; }
+  int GetLine(void) const { return m_line; }
+  int GetColumn(void) const { return m_col; }
+  uint64_t GetHash(void) const { return m_hash; }
+
+  py::str GetPreparseData(void) const { return CEngine::Precompile(m_source); }
+
+  v8::Handle<v8::Script> Handle(void) { return m_script; }
+
+  py::object Run(double timeout);
+};
+
+class CScriptCache
+{
+  struct Key
+  {
+    uint64_t hash;
+    std::string name;
+    int line, col;
+
+    Key(uint64_t h, const std::string& n, int l, int c) 
+      : hash(h), name(n), line(l), col(c)
+    {
+    }
+
+    bool operator<(const Key& other) const
+    {
+      if (hash != other.hash) return hash < other.hash;
+      if (line != other.line) return line < other.line;
+      if (col != other.col) return col < other.col;
+      return name < other.name;
+    }
+  };
+
+  typedef std::list<CScriptPtr> Entries; // most recently used first
+  typedef std::map<Key, Entries::iterator> Index;
+
+  // the engines of several threads share the cache, once they hold JSLocker 
+  mutable boost::mutex m_mutex;
+
+  size_t m_capacity;
+  Entries m_entries;
+  Index m_index;
+
+  size_t m_hits, m_misses, m_evictions;
+
+  void Evict(size_t capacity);
+public:
+  CScriptCache(size_t capacity = 256) 
+    : m_capacity(capacity), m_hits(0), m_misses(0), m_evictions(0)
+  {
+  }
+
+  CScriptPtr Lookup(const std::string& src, uint64_t hash, const std::string& name, int line, int col);
+  void Insert(CScriptPtr script);  
+
+  size_t GetCapacity(void) const { boost::mutex::scoped_lock lock(m_mutex); return m_capacity; }
+  void SetCapacity(size_t capacity);
+
+  size_t GetSize(void) const { boost::mutex::scoped_lock lock(m_mutex); return m_entries.size(); }
+  size_t GetHits(void) const { boost::mutex::scoped_lock lock(m_mutex); return m_hits; }
+  size_t GetMisses(void) const { boost::mutex::scoped_lock lock(m_mutex); return m_misses; }
+  size_t GetEvictions(void) const { boost::mutex::scoped_lock lock(m_mutex); return m_evictions; }
+
+  py::list GetScripts(void) const;
+
+  void Clear(void);
+
+  static CScriptCache& GetInstance(void)
+  {
+    // never destroyed, the scripts are released by Shutdown while V8 is still alive
+
+    static CScriptCache *s_instance = new CScriptCache();
+
+    return *s_instance;
+  }
 
-  py::object Run(void);
+  // registered with atexit, before the Python and V8 teardown
+  static void Shutdown(void) { GetInstance().Clear(); }
 };
@@ -24,6 +24,12 @@ void CJavascriptException::Expose(void)
     .def_readonly("endCol", &CJavascriptException::GetEndColumn)
     .def_readonly("sourceLine", &CJavascriptException::GetSourceLine);
 
+  py::enum_<ErrorPolicy>("JSErrorPolicy")
+    .value("Stop", StopOnError)
+    .value("Skip", SkipOnError)
+    .value("Collect", CollectErrors)
+    ;
+
   py::register_exception_translator<CJavascriptException>(ExceptionTranslator::Translate);
 
   py::converter::registry::push_back(ExceptionTranslator::Convertible,
@@ -171,12 +177,25 @@ void ExceptionTranslator::Translate(CJavascriptException const& ex)
     //
     // http://www.language-binding.net/pyplusplus/troubleshooting_guide/exceptions/exceptions.html
 
-    py::object impl(ex);
-    py::object clazz = impl.attr("_jsclass");
-    py::object err = clazz(impl);
+    py::object err = Instantiate(ex);
+
+    ::PyErr_SetObject(reinterpret_cast<PyObject *>(Py_TYPE(err.ptr())), py::incref(err.ptr()));
+  }
+}
+
+py::object ExceptionTranslator::Instantiate(CJavascriptException const& ex)
+{
+  if (ex.m_type)
+  {
+    py::object clazz(py::handle<>(py::borrowed(ex.m_type)));
 
-    ::PyErr_SetObject(clazz.ptr(), py::incref(err.ptr()));
+    return clazz(ex.what());
   }
+
+  py::object impl(ex);
+  py::object clazz = impl.attr("_jsclass");
+
+  return clazz(impl);
 }
 
 void *ExceptionTranslator::Convertible(PyObject* obj)
@@ -26,9 +26,17 @@ namespace py = boost::python;
 
 class CJavascriptException;
 
+enum ErrorPolicy
+{
+  StopOnError,  // raise the first error
+  SkipOnError,  // None in place of the failed items
+  CollectErrors // the JSError in place of the failed items
+};
+
 struct ExceptionTranslator
 {
   static void Translate(CJavascriptException const& ex);
+  static py::object Instantiate(CJavascriptException const& ex);
 
   static void *Convertible(PyObject* obj);
   static void Construct(PyObject* obj, py::converter::rvalue_from_python_stage1_data* data);
@@ -42,6 +50,7 @@ class CJavascriptException : public std::runtime_error
   v8::Persistent<v8::Message> m_msg;
 
   friend struct ExceptionTranslator;
+  friend class CEnginePool;
 
   static const std::string Extract(v8::TryCatch& try_catch);
 protected:
@@ -58,6 +67,13 @@ public:
   {
   }
 
+  CJavascriptException(const CJavascriptException& ex)
+    : std::runtime_error(ex.what()), m_type(ex.m_type),
+      m_exc(v8::Persistent<v8::Value>::New(ex.m_exc)),
+      m_msg(v8::Persistent<v8::Message>::New(ex.m_msg))
+  {
+  }
+
   ~CJavascriptException() throw()
   {
     if (!m_exc.IsEmpty()) m_exc.Dispose();
@@ -0,0 +1,64 @@
+#include "Locker.h"
+
+void CLocker::Expose(void)
+{
+  ::PyEval_InitThreads();
+
+  py::class_<CLocker, boost::noncopyable>("JSLocker", py::init<>())
+    .add_static_property("active", &CLocker::IsActive,
+                         "whether Locker is being used by this V8 instance.")
+    .add_static_property("locked", &CLocker::IsLocked,
+                         "whether or not the locker is locked by the current thread.")
+
+    .def("entered", &CLocker::IsEntered)
+
+    .def("enter", &CLocker::Enter, "Lock V8 for the current thread, "
+         "once any thread locks V8, every thread has to lock it before using V8.")
+    .def("leave", &CLocker::Leave, "Unlock V8 for the other threads.")
+    ;
+
+  py::class_<CUnlocker, boost::noncopyable>("JSUnlocker", py::init<>())
+    .def("entered", &CUnlocker::IsEntered)
+
+    .def("enter", &CUnlocker::Enter, "Temporarily unlock V8 for the other threads.")
+    .def("leave", &CUnlocker::Leave, "Lock V8 again for the current thread.")
+    ;
+}
+
+void CLocker::Enter(void)
+{
+  if (m_locker) return;
+
+  Py_BEGIN_ALLOW_THREADS
+
+  m_locker.reset(new v8::Locker());
+
+  Py_END_ALLOW_THREADS
+}
+
+void CLocker::Leave(void)
+{
+  m_locker.reset();
+}
+
+void CUnlocker::Enter(void)
+{
+  if (m_unlocker) return;
+
+  m_unlocker.reset(new v8::Unlocker());
+}
+
+void CUnlocker::Leave(void)
+{
+  Py_BEGIN_ALLOW_THREADS
+
+  m_unlocker.reset();
+
+  Py_END_ALLOW_THREADS
+}
+
+void CLocker::CheckLocked(void)
+{
+  if (v8::Locker::IsActive() && !v8::Locker::IsLocked())
+    throw CJavascriptException("V8 is shared by several threads, hold JSLocker before using it", ::PyExc_RuntimeError);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <boost/scoped_ptr.hpp>
+
+#include "Exception.h"
+
+// Threading protocol: a thread always takes the V8 lock before the Python GIL,
+// so a thread holding the GIL must release it while waiting for V8.
+
+class CPythonGIL
+{
+  PyGILState_STATE m_state;
+public:
+  CPythonGIL() : m_state(::PyGILState_Ensure())
+  {
+  }
+  ~CPythonGIL()
+  {
+    ::PyGILState_Release(m_state);
+  }
+};
+
+class CPythonAllowThreads
+{
+  PyThreadState *m_state;
+public:
+  // other Python threads may only run while V8 is locked by this thread, 
+  // otherwise they could enter V8 at the same time
+
+  CPythonAllowThreads() : m_state(v8::Locker::IsLocked() ? ::PyEval_SaveThread() : NULL)
+  {
+  }
+  ~CPythonAllowThreads()
+  {
+    if (m_state) ::PyEval_RestoreThread(m_state);
+  }
+};
+
+class CLocker
+{
+  boost::scoped_ptr<v8::Locker> m_locker;
+public:
+  bool IsEntered(void) { return m_locker.get() != NULL; }
+
+  void Enter(void);
+  void Leave(void);
+
+  static bool IsLocked(void) { return v8::Locker::IsLocked(); }
+  static bool IsActive(void) { return v8::Locker::IsActive(); }
+
+  // V8 aborts the process when a thread enters it unlocked once a locker has been used,
+  // as soon as a JSEnginePool or JSLocker exists; raise a RuntimeError instead
+  static void CheckLocked(void);
+
+  static void Expose(void);
+};
+
+class CUnlocker
+{
+  boost::scoped_ptr<v8::Unlocker> m_unlocker;
+public:
+  bool IsEntered(void) { return m_unlocker.get() != NULL; }
+
+  void Enter(void);
+  void Leave(void);
+};
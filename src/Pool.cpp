@@ -0,0 +1,299 @@
+#include "Pool.h"
+
+#include "Engine.h"
+
+void CEnginePool::Expose(void)
+{
+  ::PyEval_InitThreads();
+
+  py::class_<CEnginePool, boost::noncopyable>("JSEnginePool", 
+    py::init<size_t, size_t, size_t, size_t, size_t, size_t>((py::arg("size") = 4, 
+                                                              py::arg("heap_limit") = 0,
+                                                              py::arg("stack_limit") = 0,
+                                                              py::arg("max_young_space_size") = 0,
+                                                              py::arg("max_old_space_size") = 0,
+                                                              py::arg("max_executable_size") = 0),
+    "Create the workers, every isolate has its own heap and stack limits in bytes, 0 for the V8 defaults. "
+    "A task exceeding the heap limit raises MemoryError, the max_*_size are hard limits of V8."))
+    .add_property("size", &CEnginePool::GetSize, "The number of worker threads.")
+    .add_property("pending", &CEnginePool::GetPending, "The number of tasks waiting for a worker.")
+
+    .def("submit", &CEnginePool::Submit, (py::arg("source"), py::arg("args") = py::object(), py::arg("timeout") = 0.0),
+         "Run the source on a worker and return a JSFuture of its result, "
+         "when args is given the source must evaluate to a function called with them. "
+         "The task is terminated with JSTimeoutError after timeout seconds, 0 for no limit.")
+    .def("shutdown", &CEnginePool::Shutdown,
+         "Run the pending tasks and stop the workers.")
+    ;
+
+  py::class_<CFuture, boost::noncopyable>("JSFuture", py::no_init)
+    .add_property("done", &CFuture::IsDone)
+
+    .def("result", &CFuture::GetResult, (py::arg("timeout") = 0.0),
+         "Wait for the result at most timeout seconds, 0 to wait forever.")
+    ;
+
+  py::objects::class_value_wrapper<boost::shared_ptr<CFuture>,
+    py::objects::make_ptr_instance<CFuture,
+    py::objects::pointer_holder<boost::shared_ptr<CFuture>,CFuture> > >();
+}
+
+bool CFuture::IsDone(void)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  return m_done;
+}
+
+void CFuture::SetResult(const std::string& result)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  m_result = result;
+  m_done = true;
+
+  m_cond.notify_all();
+}
+
+void CFuture::SetError(const std::string& error, PyObject *type)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  m_error = error;
+  m_error_type = type;
+  m_done = true;
+
+  m_cond.notify_all();
+}
+
+py::object CFuture::GetResult(double timeout)
+{
+  bool done;
+
+  Py_BEGIN_ALLOW_THREADS
+
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  boost::system_time deadline = boost::get_system_time() +
+    boost::posix_time::microseconds(static_cast<int64_t>(timeout * 1000000));
+
+  while (!m_done)
+  {
+    if (timeout <= 0)
+      m_cond.wait(lock);
+    else if (!m_cond.timed_wait(lock, deadline))
+      break;
+  }
+
+  done = m_done;
+
+  Py_END_ALLOW_THREADS
+
+  if (!done) throw CJavascriptException("timed out waiting for the result", ::PyExc_RuntimeError);
+
+  if (!m_error.empty()) throw CJavascriptException(m_error, m_error_type);
+
+  if (m_result.empty()) return py::object();
+
+  return py::import("json").attr("loads")(m_result);
+}
+
+CEnginePool::CEnginePool(size_t size, size_t heap_limit, size_t stack_limit, 
+                         size_t max_young_space_size, size_t max_old_space_size, size_t max_executable_size)
+  : m_stopped(false), m_size(size), m_heap_limit(heap_limit), m_stack_limit(stack_limit),
+    m_max_young_space_size(max_young_space_size), m_max_old_space_size(max_old_space_size),
+    m_max_executable_size(max_executable_size)
+{
+  if (size == 0) throw CJavascriptException("the pool needs at least one worker", ::PyExc_ValueError);
+
+  for (size_t i=0; i<size; i++)
+  {
+    m_workers.create_thread(boost::bind(&CEnginePool::Work, this));
+  }
+}
+
+size_t CEnginePool::GetPending(void)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  return m_tasks.size();
+}
+
+CFuturePtr CEnginePool::Submit(const std::string& source, py::object args, double timeout)
+{
+  Task task;
+
+  task.source = source;
+  task.call = args.ptr() != Py_None;
+  task.timeout = timeout;
+
+  if (task.call)
+  {
+    task.args = py::extract<std::string>(py::import("json").attr("dumps")(py::list(args)));
+  }
+
+  task.future.reset(new CFuture());
+
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  if (m_stopped) throw CJavascriptException("the pool has been shutdown", ::PyExc_RuntimeError);
+
+  m_tasks.push_back(task);
+  m_cond.notify_one();
+
+  return task.future;
+}
+
+void CEnginePool::Shutdown(void)
+{
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+
+    m_stopped = true;
+    m_cond.notify_all();
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+
+  m_workers.join_all();
+
+  Py_END_ALLOW_THREADS
+}
+
+bool CEnginePool::NextTask(Task& task)
+{
+  boost::mutex::scoped_lock lock(m_mutex);
+
+  while (m_tasks.empty())
+  {
+    if (m_stopped) return false;
+
+    m_cond.wait(lock);
+  }
+
+  task = m_tasks.front();
+  m_tasks.pop_front();
+
+  return true;
+}
+
+void CEnginePool::Work(void)
+{
+  v8::Isolate *isolate = v8::Isolate::New();
+
+  {
+    v8::Locker locker(isolate);
+    v8::Isolate::Scope isolate_scope(isolate);
+
+    // the heap of a new isolate is only set up by its first context
+
+    if (m_max_young_space_size || m_max_old_space_size || m_max_executable_size)
+      CResourceLimits::SetHeapSize(m_max_young_space_size, m_max_old_space_size, m_max_executable_size);
+
+    if (m_stack_limit) CResourceLimits::SetStackLimit(m_stack_limit);
+    if (m_heap_limit) CResourceLimits::SetHeapLimit(m_heap_limit);
+
+    v8::HandleScope handle_scope;
+
+    v8::Persistent<v8::Context> context = v8::Context::New();
+
+    {
+      v8::Context::Scope context_scope(context);
+
+      v8::Handle<v8::Object> json = context->Global()->Get(v8::String::NewSymbol("JSON"))->ToObject();
+
+      Task task;
+
+      while (NextTask(task))
+      {
+        RunTask(task, json);
+
+        task.future.reset();
+      }
+    }
+
+    context.Dispose();
+
+    CResourceLimits::Release();
+  }
+
+  isolate->Dispose();
+}
+
+void CEnginePool::RunTask(Task& task, v8::Handle<v8::Object> json)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Value> result;
+
+  CWatchdog watchdog(task.timeout);
+  CExecutionScope execution_scope;
+
+  v8::Handle<v8::Script> script = v8::Script::Compile(v8::String::New(task.source.c_str(), task.source.size()));
+
+  if (!script.IsEmpty()) result = script->Run();
+
+  if (!result.IsEmpty() && task.call)
+  {
+    if (result->IsFunction())
+    {
+      v8::Handle<v8::Function> parse = v8::Handle<v8::Function>::Cast(json->Get(v8::String::NewSymbol("parse")));
+      v8::Handle<v8::Value> json_args = v8::String::New(task.args.c_str(), task.args.size());
+
+      v8::Handle<v8::Value> args = parse->Call(json, 1, &json_args);
+
+      if (!args.IsEmpty())
+      {
+        v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(args);
+
+        std::vector< v8::Handle<v8::Value> > params(array->Length());
+
+        for (size_t i=0; i<params.size(); i++)
+        {
+          params[i] = array->Get(i);
+        }
+
+        result = v8::Handle<v8::Function>::Cast(result)->Call(
+          v8::Context::GetCurrent()->Global(), params.size(), params.empty() ? NULL : &params[0]);
+      }
+    }
+    else
+    {
+      task.future->SetError("TypeError: the source must evaluate to a function to be called with the args");
+
+      return;
+    }
+  }
+
+  if (!result.IsEmpty() && !result->IsUndefined())
+  {
+    v8::Handle<v8::Function> stringify = v8::Handle<v8::Function>::Cast(json->Get(v8::String::NewSymbol("stringify")));
+
+    result = stringify->Call(json, 1, &result);
+  }
+
+  if (watchdog.IsTerminated(try_catch))
+  {
+    task.future->SetError("script execution timed out", CWatchdog::s_timeout_error);
+  }
+  else if (CResourceLimits::IsExceeded(try_catch))
+  {
+    task.future->SetError("script execution exceeded the heap limit", ::PyExc_MemoryError);
+  }
+  else if (try_catch.HasCaught())
+  {
+    task.future->SetError(CJavascriptException::Extract(try_catch));
+  }
+  else if (result.IsEmpty() || result->IsUndefined())
+  {
+    task.future->SetResult(std::string());
+  }
+  else
+  {
+    v8::String::Utf8Value str(result);
+
+    task.future->SetResult(std::string(*str, str.length()));
+  }
+}
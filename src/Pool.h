@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include "Exception.h"
+
+// Every worker of the pool owns a V8 isolate and a context, so the scripts
+// run in parallel without the Python GIL and without the default isolate.
+//
+// Objects can't be shared between isolates, the arguments and the results
+// are plain data (None, bool, numbers, strings, lists and dicts)
+// marshalled as JSON.
+//
+// The workers lock their isolates with v8::Locker, so once a pool is created
+// the threads using the default isolate have to hold JSLocker too.
+
+class CFuture
+{
+  boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+
+  bool m_done;
+  std::string m_result, m_error;
+  PyObject *m_error_type;
+public:
+  CFuture() : m_done(false), m_error_type(NULL)
+  {
+  }
+
+  bool IsDone(void);
+
+  void SetResult(const std::string& result);
+  void SetError(const std::string& error, PyObject *type = NULL);
+
+  py::object GetResult(double timeout);
+};
+
+typedef boost::shared_ptr<CFuture> CFuturePtr;
+
+class CEnginePool
+{
+  struct Task
+  {
+    std::string source, args;
+    bool call;
+    double timeout;
+
+    CFuturePtr future;
+  };
+
+  boost::mutex m_mutex;
+  boost::condition_variable m_cond;
+
+  std::deque<Task> m_tasks;
+  bool m_stopped;
+
+  boost::thread_group m_workers;
+  size_t m_size;
+
+  size_t m_heap_limit, m_stack_limit;
+  size_t m_max_young_space_size, m_max_old_space_size, m_max_executable_size;
+
+  bool NextTask(Task& task);
+
+  void Work(void);
+  void RunTask(Task& task, v8::Handle<v8::Object> json);
+public:
+  CEnginePool(size_t size, size_t heap_limit, size_t stack_limit, 
+              size_t max_young_space_size, size_t max_old_space_size, size_t max_executable_size);
+  ~CEnginePool()
+  {
+    Shutdown();
+  }
+
+  size_t GetSize(void) const { return m_size; }
+  size_t GetPending(void);
+
+  CFuturePtr Submit(const std::string& source, py::object args, double timeout);
+  void Shutdown(void);
+
+  static void Expose(void);
+};
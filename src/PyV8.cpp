@@ -2,6 +2,8 @@
 //
 #include "Engine.h"
 #include "Debug.h"
+#include "Locker.h"
+#include "Pool.h"
 
 BOOST_PYTHON_MODULE(_PyV8)
 {
@@ -10,4 +12,6 @@ BOOST_PYTHON_MODULE(_PyV8)
   CContext::Expose();
   CEngine::Expose();
   CDebug::Expose();  
+  CLocker::Expose();
+  CEnginePool::Expose();
 }
@@ -2,8 +2,12 @@
 #include "irri_fix.h"
 
 #include <vector>
+#include <set>
+#include <algorithm>
 
 #include "Context.h"
+#include "Engine.h"
+#include "Locker.h"
 
 std::ostream& operator <<(std::ostream& os, const CJavascriptObject& obj)
 { 
@@ -32,6 +36,30 @@ void CWrapper::Expose(void)
     .def("__ne__", &CJavascriptObject::Unequals)
     ;
 
+  py::def("to_py", &CJavascriptObject::ToPython, (py::arg("obj"), py::arg("deep") = true, py::arg("max_depth") = 100),
+          "Convert the object to Python in one pass, the arrays to lists and the other objects to dicts, "
+          "the functions and the deeper objects stay wrapped. Without deep only the first level is converted.");
+
+  py::class_<CJavascriptMapping, boost::noncopyable>("JSMapping", 
+    "The mapping protocol over the enumerable properties of a JSObject.", py::init<CJavascriptObjectPtr>())
+    .def("__len__", &CJavascriptMapping::Len)
+    .def("__getitem__", &CJavascriptMapping::GetItem)
+    .def("__contains__", &CJavascriptMapping::Contains)
+    .def("__iter__", &CJavascriptMapping::IterKeys)
+
+    .def("keys", &CJavascriptMapping::Keys)
+    .def("values", &CJavascriptMapping::Values)
+    .def("items", &CJavascriptMapping::Items)
+    .def("iterkeys", &CJavascriptMapping::IterKeys)
+    .def("itervalues", &CJavascriptMapping::IterValues)
+    .def("iteritems", &CJavascriptMapping::IterItems)
+    ;
+
+  py::def("register_converter", &CPythonObject::RegisterPythonConverter, 
+          (py::arg("type"), py::arg("converter")),
+          "Convert the Python objects of exactly this type with converter(obj) "
+          "before passing them to javascript, None to remove the converter.");
+
   py::class_<CJavascriptArray, py::bases<CJavascriptObject>, boost::noncopyable>("JSArray", py::no_init)
     .def(py::init<size_t>())
     .def(py::init<py::list>())    
@@ -39,12 +67,19 @@ void CWrapper::Expose(void)
     .def("__len__", &CJavascriptArray::Length)
 
     .def("__getitem__", &CJavascriptArray::GetItem)
+    .def("__getitem__", &CJavascriptArray::GetSlice)
     .def("__setitem__", &CJavascriptArray::SetItem)
     .def("__delitem__", &CJavascriptArray::DelItem)
 
-    .def("__iter__", py::range(&CJavascriptArray::begin, &CJavascriptArray::end))
+    .def("__iter__", &CJavascriptArray::Iter)
 
     .def("__contains__", &CJavascriptArray::Contains)
+
+    .def("to_list", &CJavascriptArray::ToList, 
+         "Convert the items to a list in one pass.")
+    .def("from_sequence", &CJavascriptArray::FromSequence, 
+         "Create an array of the items of a list, tuple or other sequence in one pass.")
+    .staticmethod("from_sequence")
     ;
 
   py::class_<CJavascriptFunction, py::bases<CJavascriptObject>, boost::noncopyable>("JSFunction", py::no_init)
@@ -59,9 +94,18 @@ void CWrapper::Expose(void)
     .add_property("func_owner", &CJavascriptFunction::GetOwner)
     ;
 
+  py::class_<CJavascriptObjectIterator, boost::noncopyable>("JSObjectIterator", py::no_init)
+    .def("__iter__", &CJavascriptObjectIterator::Iter)
+    .def("next", &CJavascriptObjectIterator::Next)
+    ;
+
   py::objects::class_value_wrapper<boost::shared_ptr<CJavascriptObject>, 
     py::objects::make_ptr_instance<CJavascriptObject, 
     py::objects::pointer_holder<boost::shared_ptr<CJavascriptObject>,CJavascriptObject> > >();
+
+  py::objects::class_value_wrapper<boost::shared_ptr<CJavascriptObjectIterator>, 
+    py::objects::make_ptr_instance<CJavascriptObjectIterator, 
+    py::objects::pointer_holder<boost::shared_ptr<CJavascriptObjectIterator>,CJavascriptObjectIterator> > >();
 }
 
 void CPythonObject::ThrowIf(void)
@@ -113,7 +157,7 @@ void CPythonObject::ThrowIf(void)
   v8::ThrowException(error);
 }
 
-#define TRY_HANDLE_EXCEPTION() try {
+#define TRY_HANDLE_EXCEPTION() CPythonGIL python_gil; try {
 #define END_HANDLE_EXCEPTION(result) } \
   catch (const std::exception& ex) { v8::ThrowException(v8::Exception::Error(v8::String::New(ex.what()))); } \
   catch (const py::error_already_set&) { ThrowIf(); } \
@@ -280,348 +324,2099 @@ v8::Handle<v8::Value> CPythonObject::Caller(const v8::Arguments& args)
     self = *static_cast<py::object *>(field->Value());
   }
 
-  py::object result;
-
-  switch (args.Length())
-  {
-  case 0: result = self(); break;
-  case 1: result = self(CJavascriptObject::Wrap(args[0])); break;
-  case 2: result = self(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1])); break;
-  case 3: result = self(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]), 
-                        CJavascriptObject::Wrap(args[2])); break;
-  case 4: result = self(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]), 
-                        CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3])); break;
-  case 5: result = self(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]), 
-                        CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3]),
-                        CJavascriptObject::Wrap(args[4])); break;
-  case 6: result = self(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]), 
-                        CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3]),
-                        CJavascriptObject::Wrap(args[4]), CJavascriptObject::Wrap(args[5])); break;
-  default:
-    return v8::ThrowException(v8::Exception::Error(v8::String::New("too many arguments")));
-  }
+  return handle_scope.Close(Call(self, args));
 
-  return handle_scope.Close(Wrap(result));
-  
   END_HANDLE_EXCEPTION(v8::Undefined())
 }
 
-void CPythonObject::SetupObjectTemplate(v8::Handle<v8::ObjectTemplate> clazz)
-{
-  clazz->SetInternalFieldCount(1);
-  clazz->SetNamedPropertyHandler(cazt(v8::NamedPropertyGetter, NamedGetter), NamedSetter, cazt(v8::NamedPropertyQuery, NamedQuery), NamedDeleter);
-  clazz->SetIndexedPropertyHandler(cazt(v8::IndexedPropertyGetter, IndexedGetter), IndexedSetter, cazt(v8::IndexedPropertyQuery, IndexedQuery), IndexedDeleter);
-  clazz->SetCallAsFunctionHandler(Caller);
-}
-
-v8::Persistent<v8::ObjectTemplate> CPythonObject::CreateObjectTemplate(void)
+v8::Handle<v8::Value> CPythonObject::Call(py::object callable, const v8::Arguments& args)
 {
   v8::HandleScope handle_scope;
 
-  v8::Handle<v8::ObjectTemplate> clazz = v8::ObjectTemplate::New();
+  // a trailing {__kwargs__: {...}} object holds the keyword arguments
 
-  SetupObjectTemplate(clazz);
+  static v8::Persistent<v8::String> s_kwargs = v8::Persistent<v8::String>::New(v8::String::NewSymbol("__kwargs__"));
 
-  return v8::Persistent<v8::ObjectTemplate>::New(clazz);
-}
+  int argc = args.Length();
 
-#define TRY_CONVERT(type, cls) { py::extract<type> extractor(obj); \
-  if (extractor.check()) return handle_scope.Close(cls::New(extractor())); }
+  py::object kwargs;
 
-v8::Handle<v8::Value> CPythonObject::Wrap(py::object obj)
-{
-  assert(v8::Context::InContext());
+  if (argc > 0 && args[argc-1]->IsObject() && !args[argc-1]->IsFunction() && !args[argc-1]->IsArray())
+  {
+    v8::Handle<v8::Object> last = args[argc-1]->ToObject();
 
-  v8::HandleScope handle_scope;
+    if (last->HasRealNamedProperty(s_kwargs))
+    {
+      v8::Handle<v8::Value> value = last->Get(s_kwargs);
 
-  if (obj.ptr() == Py_None) return v8::Null();
-  if (obj.ptr() == Py_True) return v8::True();
-  if (obj.ptr() == Py_False) return v8::False();
+      kwargs = py::dict();
 
-  TRY_CONVERT(int, v8::Int32);
-  TRY_CONVERT(const char *, v8::String);
-  TRY_CONVERT(bool, v8::Boolean);
-  TRY_CONVERT(double, v8::Number);  
+      if (value->IsObject())
+      {
+        v8::Handle<v8::Object> kwds = value->ToObject();
+        v8::Handle<v8::Array> names = kwds->GetOwnPropertyNames();
 
-  py::extract<CJavascriptObject&> extractor(obj);
+        for (size_t i=0; i<names->Length(); i++)
+        {
+          v8::Handle<v8::Value> name = names->Get(i);
+          v8::String::Utf8Value key(name);
 
-  if (extractor.check())
-  {
-    return handle_scope.Close(extractor().Object());
+          kwargs[py::str(*key, key.length())] = CJavascriptObject::Wrap(kwds->Get(name));
+        }
+      }
+
+      argc--;
+    }
   }
 
-  v8::Handle<v8::Value> result;
+  py::object params(py::handle<>(::PyTuple_New(argc)));
 
-  if (PyFunction_Check(obj.ptr()) || PyMethod_Check(obj.ptr()) || PyType_Check(obj.ptr()))
+  for (int i=0; i<argc; i++)
   {
-    v8::Handle<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New();    
+    py::object param = CJavascriptObject::Wrap(args[i]);
 
-    func_tmpl->SetCallHandler(Caller, v8::External::New(new py::object(obj)));
-    
-    if (PyType_Check(obj.ptr()))
-    {
-      v8::Handle<v8::String> cls_name = v8::String::New(py::extract<const char *>(obj.attr("__name__"))());
+    // PyTuple_SET_ITEM steals the reference
+    PyTuple_SET_ITEM(params.ptr(), i, py::incref(param.ptr()));
+  }
 
-      func_tmpl->SetClassName(cls_name);
-    }
+  PyObject *result = ::PyObject_Call(callable.ptr(), params.ptr(), kwargs.ptr() == Py_None ? NULL : kwargs.ptr());
 
-    result = func_tmpl->GetFunction();
-  }
-  else if (PyBool_Check(obj.ptr()))
-  {
-    result = v8::Boolean::New(py::extract<bool>(obj));
-  }
-  else if (PyString_Check(obj.ptr()))
-  {
-    result = v8::String::New(PyString_AS_STRING(obj.ptr()));
-  }
-  else if (PyUnicode_Check(obj.ptr()))
-  {
-    result = v8::String::New(reinterpret_cast<const uint16_t *>(PyUnicode_AS_UNICODE(obj.ptr())));
-  }
-  else if (PyNumber_Check(obj.ptr()))
-  {   
-    result = v8::Number::New(py::extract<double>(obj));
-  }
-  else
-  {
-    static v8::Persistent<v8::ObjectTemplate> s_template = CreateObjectTemplate();
+  if (!result) py::throw_error_already_set();
 
-    v8::Handle<v8::Object> instance = s_template->NewInstance();
+  return handle_scope.Close(Wrap(py::object(py::handle<>(result))));
+}
 
-    v8::Handle<v8::External> payload = v8::External::New(new py::object(obj));
+v8::Handle<v8::Value> CPythonObject::DictGetter(
+  v8::Local<v8::String> prop, const v8::AccessorInfo& info)
+{
+  TRY_HANDLE_EXCEPTION()
 
-    instance->SetInternalField(0, payload);
+  v8::HandleScope handle_scope;
 
-    result = instance;
-  }
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  return handle_scope.Close(result);
-}
+  PyObject *value = ::PyDict_GetItem(obj.ptr(), CJavascriptObject::WrapString(prop).ptr());
 
-void CJavascriptObject::CheckAttr(v8::Handle<v8::String> name) const
-{
-  assert(v8::Context::InContext());
+  if (value) return handle_scope.Close(Wrap(py::object(py::handle<>(py::borrowed(value)))));
 
-  if (!m_obj->Has(name))
-  {
-    std::ostringstream msg;
-      
-    msg << "'" << *v8::String::AsciiValue(m_obj->ObjectProtoToString()) 
-        << "' object has no attribute '" << *v8::String::AsciiValue(name) << "'";
+  // the methods of the dict, as get() or keys()
 
-    throw CJavascriptException(msg.str(), ::PyExc_AttributeError);
-  }
+  v8::Handle<v8::Value> result = NamedGetter(prop, info);
+
+  return result.IsEmpty() ? result : handle_scope.Close(result);
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
 }
 
-py::object CJavascriptObject::GetAttr(const std::string& name)
+v8::Handle<v8::Value> CPythonObject::DictSetter(
+  v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::AccessorInfo& info)
 {
-  v8::HandleScope handle_scope;
-
-  v8::TryCatch try_catch;
+  TRY_HANDLE_EXCEPTION()
 
-  v8::Handle<v8::String> attr_name = v8::String::New(name.c_str());
+  v8::HandleScope handle_scope;
 
-  CheckAttr(attr_name);
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::Handle<v8::Value> attr_value = m_obj->Get(attr_name);
+  if (0 > ::PyDict_SetItem(obj.ptr(), CJavascriptObject::WrapString(prop).ptr(), CJavascriptObject::Wrap(value).ptr()))
+    py::throw_error_already_set();
 
-  if (attr_value.IsEmpty()) 
-    CJavascriptException::ThrowIf(try_catch);
+  return value;
 
-  return CJavascriptObject::Wrap(attr_value, m_obj);
+  END_HANDLE_EXCEPTION(v8::Undefined())
 }
 
-void CJavascriptObject::SetAttr(const std::string& name, py::object value)
+v8::Handle<v8::Integer> CPythonObject::DictQuery(
+  v8::Local<v8::String> prop, const v8::AccessorInfo& info)
 {
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  v8::TryCatch try_catch;
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::Handle<v8::String> attr_name = v8::String::New(name.c_str());
-  v8::Handle<v8::Value> attr_obj = CPythonObject::Wrap(value);
+  if (::PyDict_GetItem(obj.ptr(), CJavascriptObject::WrapString(prop).ptr()))
+    return handle_scope.Close(v8::Integer::New(v8::None));
 
-  if (!m_obj->Set(attr_name, attr_obj)) 
-    CJavascriptException::ThrowIf(try_catch);
+  return v8::Handle<v8::Integer>();
+
+  END_HANDLE_EXCEPTION(v8::Handle<v8::Integer>())
 }
-void CJavascriptObject::DelAttr(const std::string& name)
+
+v8::Handle<v8::Boolean> CPythonObject::DictDeleter(
+  v8::Local<v8::String> prop, const v8::AccessorInfo& info)
 {
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  v8::TryCatch try_catch;
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::Handle<v8::String> attr_name = v8::String::New(name.c_str());
+  py::object key = CJavascriptObject::WrapString(prop);
 
-  CheckAttr(attr_name);
-  
-  if (!m_obj->Delete(attr_name)) 
-    CJavascriptException::ThrowIf(try_catch);
+  if (!::PyDict_GetItem(obj.ptr(), key.ptr())) return v8::Handle<v8::Boolean>();
+
+  return v8::Boolean::New(0 <= ::PyDict_DelItem(obj.ptr(), key.ptr()));
+
+  END_HANDLE_EXCEPTION(v8::False())
 }
-py::list CJavascriptObject::GetAttrList(void)
+
+v8::Handle<v8::Array> CPythonObject::DictEnumerator(const v8::AccessorInfo& info)
 {
-  py::list attrs;
+  TRY_HANDLE_EXCEPTION()
 
   v8::HandleScope handle_scope;
 
-  v8::TryCatch try_catch;
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::Handle<v8::Array> props = m_obj->GetPropertyNames();
+  v8::Handle<v8::Array> keys = v8::Array::New(::PyDict_Size(obj.ptr()));
 
-  for (size_t i=0; i<props->Length(); i++)
-  {    
-    attrs.append(CJavascriptObject::Wrap(props->Get(v8::Integer::New(i))));
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+  uint32_t idx = 0;
+
+  while (::PyDict_Next(obj.ptr(), &pos, &key, &value))
+  {
+    py::object name(py::handle<>(py::borrowed(key)));
+
+    keys->Set(idx++, PyString_Check(key) || PyUnicode_Check(key) ? 
+      v8::Handle<v8::Value>(WrapString(name)) : v8::Handle<v8::Value>(Wrap(name)->ToString()));
   }
 
-  if (try_catch.HasCaught()) CJavascriptException::ThrowIf(try_catch);
+  return handle_scope.Close(keys);
 
-  return attrs;
+  END_HANDLE_EXCEPTION(v8::Handle<v8::Array>())
 }
 
-bool CJavascriptObject::Equals(CJavascriptObjectPtr other) const
+// the int key of an index if the dict has it, or else its string key
+
+static py::object GetIndexKey(PyObject *dict, uint32_t index)
 {
-  v8::HandleScope handle_scope;
+  py::object key(py::handle<>(::PyInt_FromSize_t(index)));
 
-  return m_obj->Equals(other->m_obj);
+  if (::PyDict_GetItem(dict, key.ptr())) return key;
+
+  py::object name(py::handle<>(::PyString_FromFormat("%u", index)));
+
+  return ::PyDict_GetItem(dict, name.ptr()) ? name : key;
 }
 
-void CJavascriptObject::Dump(std::ostream& os) const
+v8::Handle<v8::Value> CPythonObject::DictIndexedGetter(
+  uint32_t index, const v8::AccessorInfo& info)
 {
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  if (m_obj.IsEmpty())
-    os << "None";
-  else if (m_obj->IsInt32())
-    os << m_obj->Int32Value();
-  else if (m_obj->IsNumber())
-    os << m_obj->NumberValue();
-  else if (m_obj->IsBoolean())
-    os << m_obj->BooleanValue();
-  else if (m_obj->IsNull())
-    os << "None";
-  else if (m_obj->IsUndefined())
-    os << "N/A";
-  else if (m_obj->IsString())  
-    os << *v8::String::AsciiValue(v8::Handle<v8::String>::Cast(m_obj));  
-  else 
-    os << *v8::String::AsciiValue(m_obj->ToString());
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
+
+  PyObject *value = ::PyDict_GetItem(obj.ptr(), GetIndexKey(obj.ptr(), index).ptr());
+
+  if (!value) return v8::Handle<v8::Value>();
+
+  return handle_scope.Close(Wrap(py::object(py::handle<>(py::borrowed(value)))));
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
 }
 
-CJavascriptObject::operator long() const 
-{ 
+v8::Handle<v8::Value> CPythonObject::DictIndexedSetter(
+  uint32_t index, v8::Local<v8::Value> value, const v8::AccessorInfo& info)
+{
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  if (m_obj.IsEmpty())
-    throw CJavascriptException("argument must be a string or a number, not 'NoneType'", ::PyExc_TypeError);
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  return m_obj->Int32Value(); 
+  if (0 > ::PyDict_SetItem(obj.ptr(), GetIndexKey(obj.ptr(), index).ptr(), CJavascriptObject::Wrap(value).ptr()))
+    py::throw_error_already_set();
+
+  return value;
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
 }
-CJavascriptObject::operator double() const 
-{ 
+
+v8::Handle<v8::Integer> CPythonObject::DictIndexedQuery(
+  uint32_t index, const v8::AccessorInfo& info)
+{
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  if (m_obj.IsEmpty())
-    throw CJavascriptException("argument must be a string or a number, not 'NoneType'", ::PyExc_TypeError);
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  return m_obj->NumberValue(); 
+  if (::PyDict_GetItem(obj.ptr(), GetIndexKey(obj.ptr(), index).ptr()))
+    return handle_scope.Close(v8::Integer::New(v8::None));
+
+  return v8::Handle<v8::Integer>();
+
+  END_HANDLE_EXCEPTION(v8::Handle<v8::Integer>())
 }
 
-CJavascriptObject::operator bool() const
+v8::Handle<v8::Boolean> CPythonObject::DictIndexedDeleter(
+  uint32_t index, const v8::AccessorInfo& info)
 {
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  if (m_obj.IsEmpty()) return false;
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  return m_obj->BooleanValue();
+  py::object key = GetIndexKey(obj.ptr(), index);
+
+  if (!::PyDict_GetItem(obj.ptr(), key.ptr())) return v8::Handle<v8::Boolean>();
+
+  return v8::Boolean::New(0 <= ::PyDict_DelItem(obj.ptr(), key.ptr()));
+
+  END_HANDLE_EXCEPTION(v8::False())
 }
 
-py::object CJavascriptObject::Wrap(v8::Handle<v8::Value> value, v8::Handle<v8::Object> self)
+v8::Handle<v8::Value> CPythonObject::SequenceGetter(
+  uint32_t index, const v8::AccessorInfo& info)
 {
-  assert(v8::Context::InContext());
+  TRY_HANDLE_EXCEPTION()
 
   v8::HandleScope handle_scope;
 
-  if (value.IsEmpty() || value->IsNull()) return py::object(py::handle<>(Py_None));
-  if (value->IsTrue()) return py::object(py::handle<>(Py_True));
-  if (value->IsFalse()) return py::object(py::handle<>(Py_False));
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  if (value->IsInt32()) return py::object(value->Int32Value());  
-  if (value->IsString())
-  {
-    v8::String::AsciiValue str(v8::Handle<v8::String>::Cast(value));
+  if (index >= static_cast<size_t>(Py_SIZE(obj.ptr()))) return v8::Handle<v8::Value>();
 
-    return py::str(*str, str.length());
-  }
-  if (value->IsBoolean()) return py::object(py::handle<>(value->BooleanValue() ? Py_True : Py_False));
-  if (value->IsNumber()) return py::object(py::handle<>(::PyFloat_FromDouble(value->NumberValue())));
+  PyObject *item = PyList_Check(obj.ptr()) ? PyList_GET_ITEM(obj.ptr(), index) : PyTuple_GET_ITEM(obj.ptr(), index);
 
-  return Wrap(value->ToObject(), self);
+  return handle_scope.Close(Wrap(py::object(py::handle<>(py::borrowed(item)))));
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
 }
 
-py::object CJavascriptObject::Wrap(v8::Handle<v8::Object> obj, v8::Handle<v8::Object> self) 
+v8::Handle<v8::Value> CPythonObject::SequenceSetter(
+  uint32_t index, v8::Local<v8::Value> value, const v8::AccessorInfo& info)
 {
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  if (obj.IsEmpty())
-  {
-    return py::object(py::handle<>(Py_None));
-  }
-  else if (obj->IsArray())
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
+
+  if (!PyList_Check(obj.ptr()))
   {
-    v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(obj);
+    v8::ThrowException(v8::Exception::TypeError(v8::String::New("'tuple' object does not support item assignment")));
 
-    return Wrap(new CJavascriptArray(array));
+    return value;
   }
-  else if (obj->IsFunction())
-  {
-    v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(obj);
 
-    if (func->InternalFieldCount() == 1)
-    {
-      v8::Handle<v8::External> field = v8::Handle<v8::External>::Cast(func->GetInternalField(0));
+  py::object item = CJavascriptObject::Wrap(value);
 
-      return *static_cast<py::object *>(field->Value());
-    }
+  size_t size = PyList_GET_SIZE(obj.ptr());
 
-    return Wrap(new CJavascriptFunction(self, func));
+  if (index < size)
+  {
+    // PyList_SetItem steals the reference
+    ::PyList_SetItem(obj.ptr(), index, py::incref(item.ptr()));
   }
-  else if (obj->IsObject() && obj->InternalFieldCount() == 1)
+  else if (index == size)
   {
-    v8::Handle<v8::External> field = v8::Handle<v8::External>::Cast(obj->GetInternalField(0));
-
-    return *static_cast<py::object *>(field->Value());   
+    if (0 > ::PyList_Append(obj.ptr(), item.ptr())) py::throw_error_already_set();
+  }
+  else
+  {
+    v8::ThrowException(v8::Exception::RangeError(v8::String::New("list assignment index out of range")));
   }
 
-  return Wrap(new CJavascriptObject(obj));
-}
+  return value;
 
-py::object CJavascriptObject::Wrap(CJavascriptObject *obj)
-{
-  return py::object(py::handle<>(boost::python::converter::shared_ptr_to_python<CJavascriptObject>(CJavascriptObjectPtr(obj))));
+  END_HANDLE_EXCEPTION(v8::Undefined())
 }
 
-CJavascriptArray::CJavascriptArray(size_t size)  
+v8::Handle<v8::Integer> CPythonObject::SequenceQuery(
+  uint32_t index, const v8::AccessorInfo& info)
 {
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  v8::Handle<v8::Array> array = v8::Array::New(size);
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  m_obj = v8::Persistent<v8::Object>::New(array);  
+  if (index < static_cast<size_t>(Py_SIZE(obj.ptr())))
+    return handle_scope.Close(v8::Integer::New(PyList_Check(obj.ptr()) ? v8::None : v8::ReadOnly));
+
+  return v8::Handle<v8::Integer>();
+
+  END_HANDLE_EXCEPTION(v8::Handle<v8::Integer>())
 }
-CJavascriptArray::CJavascriptArray(py::list items)
+
+v8::Handle<v8::Boolean> CPythonObject::SequenceDeleter(
+  uint32_t index, const v8::AccessorInfo& info)
 {
+  TRY_HANDLE_EXCEPTION()
+
   v8::HandleScope handle_scope;
 
-  size_t size = ::PyList_Size(items.ptr());
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::Handle<v8::Array> array = v8::Array::New(size);
+  if (index >= static_cast<size_t>(Py_SIZE(obj.ptr()))) return v8::Handle<v8::Boolean>();
 
-  for (size_t i=0; i<size; i++)
+  if (!PyList_Check(obj.ptr())) return v8::False();
+
+  return v8::Boolean::New(0 <= ::PySequence_DelItem(obj.ptr(), index));
+
+  END_HANDLE_EXCEPTION(v8::False())
+}
+
+v8::Handle<v8::Array> CPythonObject::SequenceEnumerator(const v8::AccessorInfo& info)
+{
+  TRY_HANDLE_EXCEPTION()
+
+  v8::HandleScope handle_scope;
+
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
+
+  Py_ssize_t size = Py_SIZE(obj.ptr());
+
+  v8::Handle<v8::Array> indexes = v8::Array::New(size);
+
+  for (Py_ssize_t i=0; i<size; i++)
+  {
+    indexes->Set(i, v8::Integer::New(i));
+  }
+
+  return handle_scope.Close(indexes);
+
+  END_HANDLE_EXCEPTION(v8::Handle<v8::Array>())
+}
+
+v8::Handle<v8::Value> CPythonObject::SequenceLength(
+  v8::Local<v8::String> prop, const v8::AccessorInfo& info)
+{
+  TRY_HANDLE_EXCEPTION()
+
+  v8::HandleScope handle_scope;
+
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
+
+  return handle_scope.Close(v8::Integer::New(Py_SIZE(obj.ptr())));
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
+}
+
+v8::Handle<v8::Value> CPythonObject::InstanceGetter(
+  v8::Local<v8::String> prop, const v8::AccessorInfo& info)
+{
+  TRY_HANDLE_EXCEPTION()
+
+  v8::HandleScope handle_scope;
+
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
+
+  py::object name = CJavascriptObject::WrapString(prop);
+
+  // as PyObject_GenericGetAttr, the data descriptors of the class win over the instance dict
+
+  PyObject *descr = ::_PyType_Lookup(Py_TYPE(obj.ptr()), name.ptr());
+
+  PyObject **dict = descr && PyDescr_IsData(descr) ? NULL : ::_PyObject_GetDictPtr(obj.ptr());
+
+  if (dict && *dict)
+  {
+    PyObject *value = ::PyDict_GetItem(*dict, name.ptr());
+
+    if (value) return handle_scope.Close(Wrap(py::object(py::handle<>(py::borrowed(value)))));
+  }
+
+  // the class members are found by V8 on the instance and its prototype
+
+  if (info.Holder()->HasRealNamedProperty(prop) || 
+      info.Holder()->GetPrototype()->ToObject()->HasRealNamedProperty(prop))
+    return v8::Local<v8::Value>();
+
+  v8::Handle<v8::Value> result = NamedGetter(prop, info);
+
+  return result.IsEmpty() ? result : handle_scope.Close(result);
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
+}
+
+v8::Handle<v8::Value> CPythonObject::MemberGetter(
+  v8::Local<v8::String> prop, const v8::AccessorInfo& info)
+{
+  TRY_HANDLE_EXCEPTION()
+
+  v8::HandleScope handle_scope;
+
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
+
+  py::object name = CJavascriptObject::WrapString(prop);
+
+  PyObject *value = ::PyObject_GetAttr(obj.ptr(), name.ptr());
+
+  // an unset slot or a property raising AttributeError reads as undefined, as a missing attribute
+
+  if (!value && ::PyErr_ExceptionMatches(::PyExc_AttributeError))
+  {
+    ::PyErr_Clear();
+
+    return v8::Undefined();
+  }
+
+  return handle_scope.Close(Wrap(py::object(py::handle<>(value))));
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
+}
+
+v8::Handle<v8::Value> CPythonObject::MethodCaller(const v8::Arguments& args)
+{
+  TRY_HANDLE_EXCEPTION()
+
+  v8::HandleScope handle_scope;
+
+  // as the JS methods, a detached method has to be bound to its instance explicitly
+
+  if (args.This().IsEmpty() || args.This()->InternalFieldCount() != 1)
+  {
+    v8::ThrowException(v8::Exception::TypeError(v8::String::New(
+      "the method of a Python object is called without its instance, bind it first")));
+
+    return v8::Undefined();
+  }
+
+  py::object obj = CJavascriptObject::Wrap(args.This());
+
+  py::object name = CJavascriptObject::WrapString(v8::Handle<v8::String>::Cast(args.Data()));
+
+  // looked up on every call, the class may be patched after its template was built
+  py::object method(py::handle<>(::PyObject_GetAttr(obj.ptr(), name.ptr())));
+
+  return handle_scope.Close(Call(method, args));
+
+  END_HANDLE_EXCEPTION(v8::Undefined())
+}
+
+void CPythonObject::SetupObjectTemplate(v8::Handle<v8::ObjectTemplate> clazz, bool indexed)
+{
+  clazz->SetInternalFieldCount(1);
+  clazz->SetNamedPropertyHandler(cazt(v8::NamedPropertyGetter, NamedGetter), NamedSetter, cazt(v8::NamedPropertyQuery, NamedQuery), NamedDeleter);
+
+  // the interceptors would shadow the elements of an external array
+  if (indexed)
+    clazz->SetIndexedPropertyHandler(cazt(v8::IndexedPropertyGetter, IndexedGetter), IndexedSetter, cazt(v8::IndexedPropertyQuery, IndexedQuery), IndexedDeleter);
+
+  clazz->SetCallAsFunctionHandler(Caller);
+}
+
+v8::Persistent<v8::ObjectTemplate> CPythonObject::CreateObjectTemplate(bool indexed)
+{
+  v8::HandleScope handle_scope;
+
+  v8::Handle<v8::ObjectTemplate> clazz = v8::ObjectTemplate::New();
+
+  SetupObjectTemplate(clazz, indexed);
+
+  return v8::Persistent<v8::ObjectTemplate>::New(clazz);
+}
+
+v8::Persistent<v8::ObjectTemplate> CPythonObject::CreateDictTemplate(void)
+{
+  v8::HandleScope handle_scope;
+
+  v8::Handle<v8::ObjectTemplate> clazz = v8::ObjectTemplate::New();
+
+  clazz->SetInternalFieldCount(1);
+  clazz->SetNamedPropertyHandler(DictGetter, DictSetter, DictQuery, DictDeleter, DictEnumerator);
+  clazz->SetIndexedPropertyHandler(DictIndexedGetter, DictIndexedSetter, DictIndexedQuery, DictIndexedDeleter);
+
+  return v8::Persistent<v8::ObjectTemplate>::New(clazz);
+}
+
+v8::Persistent<v8::ObjectTemplate> CPythonObject::CreateSequenceTemplate(void)
+{
+  v8::HandleScope handle_scope;
+
+  v8::Handle<v8::ObjectTemplate> clazz = v8::ObjectTemplate::New();
+
+  clazz->SetInternalFieldCount(1);
+  clazz->SetNamedPropertyHandler(cazt(v8::NamedPropertyGetter, NamedGetter), NamedSetter, cazt(v8::NamedPropertyQuery, NamedQuery), NamedDeleter);
+  clazz->SetIndexedPropertyHandler(SequenceGetter, SequenceSetter, SequenceQuery, SequenceDeleter, SequenceEnumerator);
+  clazz->SetAccessor(v8::String::NewSymbol("length"), SequenceLength, 0, v8::Handle<v8::Value>(), 
+                     v8::DEFAULT, static_cast<v8::PropertyAttribute>(v8::ReadOnly | v8::DontEnum));
+
+  return v8::Persistent<v8::ObjectTemplate>::New(clazz);
+}
+
+CPythonObject::TypeTemplates& CPythonObject::GetTypeTemplates(void)
+{
+  static TypeTemplates s_templates;
+
+  return s_templates;
+}
+
+std::vector< v8::Persistent<v8::FunctionTemplate> >& CPythonObject::GetReleasedTypeTemplates(void)
+{
+  static std::vector< v8::Persistent<v8::FunctionTemplate> > s_released;
+
+  return s_released;
+}
+
+void CPythonObject::ReleaseTypeTemplate(py::object ref)
+{
+  // called by Python when the type is freed, maybe without the V8 lock, 
+  // so the template is only disposed by the next GetTypeTemplate
+
+  TypeTemplates& templates = GetTypeTemplates();
+
+  for (TypeTemplates::iterator it = templates.begin(); it != templates.end(); it++)
+  {
+    if (it->second.second == ref.ptr())
+    {
+      GetReleasedTypeTemplates().push_back(it->second.first);
+
+      Py_DECREF(it->second.second);
+
+      templates.erase(it);
+
+      break;
+    }
+  }
+}
+
+v8::Handle<v8::FunctionTemplate> CPythonObject::GetTypeTemplate(PyTypeObject *type)
+{
+  std::vector< v8::Persistent<v8::FunctionTemplate> >& released = GetReleasedTypeTemplates();
+
+  for (size_t i=0; i<released.size(); i++) released[i].Dispose();
+
+  released.clear();
+
+  TypeTemplates& templates = GetTypeTemplates();
+
+  TypeTemplates::const_iterator it = templates.find(type);
+
+  if (it != templates.end()) return it->second.first;
+
+  v8::HandleScope handle_scope;
+
+  v8::Handle<v8::FunctionTemplate> clazz = v8::FunctionTemplate::New();
+
+  clazz->SetClassName(v8::String::NewSymbol(type->tp_name));
+
+  v8::Handle<v8::ObjectTemplate> instance = clazz->InstanceTemplate();
+  v8::Handle<v8::ObjectTemplate> prototype = clazz->PrototypeTemplate();
+
+  // only the instances with a dict or a custom lookup have attributes beyond the class members, 
+  // the others are read by V8 from the accessors and the prototype without calling back, 
+  // so they don't see the members added to the class after its template was built
+
+  v8::NamedPropertyGetter getter = 0;
+
+  if (type->tp_dictoffset != 0 || type->tp_getattro != ::PyObject_GenericGetAttr)
+    getter = cazt(v8::NamedPropertyGetter, InstanceGetter);
+
+  instance->SetInternalFieldCount(1);
+  instance->SetNamedPropertyHandler(getter, NamedSetter, cazt(v8::NamedPropertyQuery, NamedQuery), NamedDeleter);
+  instance->SetIndexedPropertyHandler(cazt(v8::IndexedPropertyGetter, IndexedGetter), IndexedSetter, cazt(v8::IndexedPropertyQuery, IndexedQuery), IndexedDeleter);
+  instance->SetCallAsFunctionHandler(Caller);
+
+  std::set<std::string> members;
+
+  for (Py_ssize_t i=0; i < PyTuple_GET_SIZE(type->tp_mro); i++)
+  {
+    PyObject *base = PyTuple_GET_ITEM(type->tp_mro, i);
+
+    if (!PyType_Check(base) || base == reinterpret_cast<PyObject *>(&PyBaseObject_Type)) continue;
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+
+    while (::PyDict_Next(reinterpret_cast<PyTypeObject *>(base)->tp_dict, &pos, &key, &value))
+    {
+      if (!PyString_Check(key)) continue;
+
+      std::string name(PyString_AS_STRING(key), PyString_GET_SIZE(key));
+
+      // the special methods are Python protocols, the first class of the MRO wins
+
+      if (name.size() > 4 && name.compare(0, 2, "__") == 0 && name.compare(name.size()-2, 2, "__") == 0) continue;
+
+      if (!members.insert(name).second) continue;
+
+      v8::Handle<v8::String> symbol = v8::String::NewSymbol(name.c_str(), name.size());
+
+      if (PyFunction_Check(value))
+        prototype->Set(symbol, v8::FunctionTemplate::New(MethodCaller, symbol), v8::DontEnum);
+      else
+        instance->SetAccessor(symbol, MemberGetter, 0, v8::Handle<v8::Value>(), v8::DEFAULT, v8::DontEnum);
+    }
+  }
+
+  // the template is released with its type, so the address of the type can't be reused meanwhile
+
+  static py::object s_release = py::make_function(&CPythonObject::ReleaseTypeTemplate);
+
+  PyObject *ref = ::PyWeakref_NewRef(reinterpret_cast<PyObject *>(type), s_release.ptr());
+
+  if (!ref)
+  {
+    // the template still works, the next conversion of the type just builds it again
+
+    ::PyErr_Clear();
+
+    return handle_scope.Close(clazz);
+  }
+
+  v8::Persistent<v8::FunctionTemplate>& cached = templates[type].first;
+
+  cached = v8::Persistent<v8::FunctionTemplate>::New(clazz);
+  templates[type].second = ref;
+
+  return cached;
+}
+
+CPythonObject::Converters& CPythonObject::GetConverters(void)
+{
+  static Converters s_converters;
+
+  if (s_converters.empty())
+  {
+    s_converters[Py_TYPE(Py_None)] = ConvertNone;
+    s_converters[&PyBool_Type] = ConvertBool;
+    s_converters[&PyInt_Type] = ConvertInt;
+    s_converters[&PyLong_Type] = ConvertLong;
+    s_converters[&PyFloat_Type] = ConvertFloat;
+    s_converters[&PyString_Type] = ConvertString;
+    s_converters[&PyUnicode_Type] = ConvertUnicode;
+    s_converters[&PyFunction_Type] = ConvertCallable;
+    s_converters[&PyMethod_Type] = ConvertCallable;
+    s_converters[&PyType_Type] = ConvertCallable;
+    s_converters[&PyList_Type] = ConvertSequence;
+    s_converters[&PyTuple_Type] = ConvertSequence;
+    s_converters[&PyDict_Type] = ConvertDict;
+  }
+
+  return s_converters;
+}
+
+CPythonObject::PythonConverters& CPythonObject::GetPythonConverters(void)
+{
+  // leaked on purpose, a static map would decref the converter callables from its 
+  // destructor at exit, after Python finalized
+
+  static PythonConverters *s_converters = new PythonConverters();
+
+  return *s_converters;
+}
+
+void CPythonObject::RegisterConverter(PyTypeObject *type, Converter converter)
+{
+  GetConverters()[type] = converter;
+}
+
+void CPythonObject::RegisterPythonConverter(py::object type, py::object converter)
+{
+  if (!PyType_Check(type.ptr()))
+    throw CJavascriptException("expect a new-style class", ::PyExc_TypeError);
+
+  PyTypeObject *type_obj = reinterpret_cast<PyTypeObject *>(type.ptr());
+
+  Converters& converters = GetConverters();
+  PythonConverters& py_converters = GetPythonConverters();
+
+  PythonConverters::iterator it = py_converters.find(type_obj);
+
+  if (converter.ptr() == Py_None)
+  {
+    if (it == py_converters.end()) return;
+
+    if (it->second.previous)
+      converters[type_obj] = it->second.previous;
+    else
+      converters.erase(type_obj);
+
+    py_converters.erase(it);
+  }
+  else
+  {
+    if (!PyCallable_Check(converter.ptr()))
+      throw CJavascriptException("expect a callable converter", ::PyExc_TypeError);
+
+    if (it == py_converters.end())
+    {
+      Converters::const_iterator found = converters.find(type_obj);
+
+      CPythonConverter entry = { converter, found == converters.end() ? NULL : found->second };
+
+      py_converters[type_obj] = entry;
+    }
+    else
+    {
+      it->second.callable = converter;
+    }
+
+    converters[type_obj] = ConvertByPython;
+  }
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertNone(py::object obj)
+{
+  return v8::Null();
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertBool(py::object obj)
+{
+  return obj.ptr() == Py_True ? v8::True() : v8::False();
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertInt(py::object obj)
+{
+  long value = PyInt_AS_LONG(obj.ptr());
+
+  if (static_cast<int32_t>(value) == value) 
+    return v8::Int32::New(static_cast<int32_t>(value));
+
+  return v8::Number::New(static_cast<double>(value));
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertLong(py::object obj)
+{
+  int overflow = 0;
+
+  long value = ::PyLong_AsLongAndOverflow(obj.ptr(), &overflow);
+
+  if (!overflow && static_cast<int32_t>(value) == value) 
+    return v8::Int32::New(static_cast<int32_t>(value));
+
+  double number = ::PyLong_AsDouble(obj.ptr());
+
+  if (number == -1.0 && ::PyErr_Occurred()) py::throw_error_already_set();
+
+  return v8::Number::New(number);
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertFloat(py::object obj)
+{
+  return v8::Number::New(PyFloat_AS_DOUBLE(obj.ptr()));
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertString(py::object obj)
+{
+  return WrapString(obj);
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertUnicode(py::object obj)
+{
+  return WrapString(obj);
+}
+
+// The large strings are shared with V8 instead of copied into its heap, 
+// the resource holds a reference to the immutable Python string until V8 collects it.
+
+class CPythonStringResource : public v8::String::ExternalAsciiStringResource
+{
+  PyObject *m_str;
+public:
+  CPythonStringResource(PyObject *str) : m_str(str)
+  {
+    Py_INCREF(m_str);
+  }
+  virtual ~CPythonStringResource()
+  {
+    CPythonGIL python_gil;
+
+    Py_DECREF(m_str);
+  }
+
+  virtual const char *data() const { return PyString_AS_STRING(m_str); }
+  virtual size_t length() const { return PyString_GET_SIZE(m_str); }
+};
+
+#if Py_UNICODE_SIZE == 2
+
+class CPythonUnicodeResource : public v8::String::ExternalStringResource
+{
+  PyObject *m_str;
+public:
+  CPythonUnicodeResource(PyObject *str) : m_str(str)
+  {
+    Py_INCREF(m_str);
+  }
+  virtual ~CPythonUnicodeResource()
+  {
+    CPythonGIL python_gil;
+
+    Py_DECREF(m_str);
+  }
+
+  virtual const uint16_t *data() const { return reinterpret_cast<const uint16_t *>(PyUnicode_AS_UNICODE(m_str)); }
+  virtual size_t length() const { return PyUnicode_GET_SIZE(m_str); }
+};
+
+#endif
+
+// SWAR scans, a word of 8 bytes at a time, the portable way without 
+// depending on the SIMD intrinsics of a compiler
+
+static bool IsAscii(const char *str, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t word;
+
+    memcpy(&word, str + i, sizeof(word));
+
+    if (word & 0x8080808080808080ULL) return false;
+  }
+
+  for (; i<len; i++)
+  {
+    if (static_cast<unsigned char>(str[i]) & 0x80) return false;
+  }
+
+  return true;
+}
+
+static bool IsAscii(const uint16_t *str, size_t len)
+{
+  size_t i = 0;
+
+  for (; i + 4 <= len; i += 4)
+  {
+    uint64_t word;
+
+    memcpy(&word, str + i, sizeof(word));
+
+    if (word & 0xFF80FF80FF80FF80ULL) return false;
+  }
+
+  for (; i<len; i++)
+  {
+    if (str[i] & 0xFF80) return false;
+  }
+
+  return true;
+}
+
+v8::Handle<v8::String> CPythonObject::WrapString(py::object obj)
+{
+  if (PyString_Check(obj.ptr()))
+  {
+    const char *str = PyString_AS_STRING(obj.ptr());
+    Py_ssize_t len = PyString_GET_SIZE(obj.ptr());
+
+    // V8 expects ASCII in the external one-byte strings, the others are decoded as UTF-8
+
+    if (len >= EXTERNAL_STRING_THRESHOLD && IsAscii(str, len))
+      return v8::String::NewExternal(new CPythonStringResource(obj.ptr()));
+
+    return v8::String::New(str, len);
+  }
+
+  if (!PyUnicode_Check(obj.ptr()))
+    throw CJavascriptException("expect a str or unicode object", ::PyExc_TypeError);
+
+  const Py_UNICODE *str = PyUnicode_AS_UNICODE(obj.ptr());
+  Py_ssize_t len = PyUnicode_GET_SIZE(obj.ptr());
+
+#if Py_UNICODE_SIZE == 2
+  if (len >= EXTERNAL_STRING_THRESHOLD)
+    return v8::String::NewExternal(new CPythonUnicodeResource(obj.ptr()));
+
+  return v8::String::New(reinterpret_cast<const uint16_t *>(str), len);
+#else
+  // UCS4 build, encode the code points above BMP as UTF-16 surrogate pairs
+
+  std::vector<uint16_t> buf;
+
+  buf.reserve(len);
+
+  for (Py_ssize_t i=0; i<len; i++)
+  {
+    Py_UCS4 ch = str[i];
+
+    if (ch > 0xFFFF)
+    {
+      ch -= 0x10000;
+
+      buf.push_back(static_cast<uint16_t>(0xD800 | (ch >> 10)));
+      buf.push_back(static_cast<uint16_t>(0xDC00 | (ch & 0x3FF)));
+    }
+    else
+    {
+      buf.push_back(static_cast<uint16_t>(ch));
+    }
+  }
+
+  return v8::String::New(buf.empty() ? NULL : &buf[0], buf.size());
+#endif
+}
+
+size_t CPythonObject::s_alive_wrappers = 0;
+size_t CPythonObject::s_released_wrappers = 0;
+
+CPythonObject::ObjectCache& CPythonObject::GetObjectCache(void)
+{
+  static ObjectCache s_cache;
+
+  return s_cache;
+}
+
+v8::Handle<v8::Object> CPythonObject::FindCachedObject(PyObject *obj)
+{
+  ObjectCache& cache = GetObjectCache();
+
+  std::pair<ObjectCache::iterator, ObjectCache::iterator> range = cache.equal_range(obj);
+
+  if (range.first == range.second) return v8::Handle<v8::Object>();
+
+  v8::Handle<v8::Context> context = v8::Context::GetCurrent();
+
+  for (ObjectCache::iterator it = range.first; it != range.second; it++)
+  {
+    if (!it->second.IsNearDeath() && it->second->CreationContext() == context) return it->second;
+  }
+
+  return v8::Handle<v8::Object>();
+}
+
+void CPythonObject::CacheObject(py::object *payload, v8::Handle<v8::Object> wrapper)
+{
+  ObjectCache::iterator it = GetObjectCache().insert(std::make_pair(payload->ptr(), v8::Persistent<v8::Object>::New(wrapper)));
+
+  it->second.MakeWeak(payload, DisposeCachedObject);
+
+  s_alive_wrappers++;
+}
+
+void CPythonObject::DisposeCachedObject(v8::Persistent<v8::Value> wrapper, void *parameter)
+{
+  py::object *payload = static_cast<py::object *>(parameter);
+
+  ObjectCache& cache = GetObjectCache();
+
+  std::pair<ObjectCache::iterator, ObjectCache::iterator> range = cache.equal_range(payload->ptr());
+
+  ObjectCache::iterator it = range.first;
+
+  while (it != range.second && it->second != wrapper) it++;
+
+  if (it != range.second)
+    cache.erase(it);
+
+  wrapper.Dispose();
+
+  {
+    // V8 may collect the wrappers while running javascript without the GIL
+
+    CPythonGIL python_gil;
+
+    delete payload;
+  }
+
+  s_alive_wrappers--;
+  s_released_wrappers++;
+}
+
+py::dict CPythonObject::GetWrapperStatistics(void)
+{
+  py::dict result;
+
+  result["alive"] = s_alive_wrappers;
+  result["released"] = s_released_wrappers;
+
+  return result;
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertCallable(py::object obj)
+{
+  v8::Handle<v8::Object> cached = FindCachedObject(obj.ptr());
+
+  if (!cached.IsEmpty()) return cached;
+
+  if (!PyType_Check(obj.ptr()))
+  {
+    // V8 keeps the function of a FunctionTemplate in its context, and a bound method 
+    // is a new object on every access, so the functions and methods share a callable 
+    // object template whose instances are collected with their weak wrapper
+
+    static v8::Persistent<v8::ObjectTemplate> s_template = CreateObjectTemplate();
+
+    return AttachObject(obj, s_template->NewInstance());
+  }
+
+  v8::Handle<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New();    
+
+  py::object *payload = new py::object(obj);
+
+  func_tmpl->SetCallHandler(Caller, v8::External::New(payload));
+  func_tmpl->SetClassName(v8::String::New(py::extract<const char *>(obj.attr("__name__"))()));
+
+  v8::Handle<v8::Function> func = func_tmpl->GetFunction();
+
+  CacheObject(payload, func);
+
+  return func;
+}
+
+v8::Handle<v8::Object> CPythonObject::AttachObject(py::object obj, v8::Handle<v8::Object> instance)
+{
+  py::object *payload = new py::object(obj);
+
+  instance->SetInternalField(0, v8::External::New(payload));
+
+  CacheObject(payload, instance);
+
+  return instance;
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertDict(py::object obj)
+{
+  v8::Handle<v8::Object> cached = FindCachedObject(obj.ptr());
+
+  if (!cached.IsEmpty()) return cached;
+
+  static v8::Persistent<v8::ObjectTemplate> s_template = CreateDictTemplate();
+
+  return AttachObject(obj, s_template->NewInstance());
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertSequence(py::object obj)
+{
+  v8::Handle<v8::Object> cached = FindCachedObject(obj.ptr());
+
+  if (!cached.IsEmpty()) return cached;
+
+  static v8::Persistent<v8::ObjectTemplate> s_template = CreateSequenceTemplate();
+
+  return AttachObject(obj, s_template->NewInstance());
+}
+
+static bool GetExternalArrayType(const char *format, Py_ssize_t itemsize, v8::ExternalArrayType& type)
+{
+  // the native struct formats of a single item, as the buffers of bytearray or numpy
+
+  if (!format) format = "B";
+
+  if (*format == '@' || *format == '=') format++;
+
+  if (!format[0] || format[1]) return false;
+
+  Py_ssize_t size;
+
+  switch (format[0])
+  {
+  case 'b': type = v8::kExternalByteArray; size = 1; break;
+  case 'B':
+  case 'c': type = v8::kExternalUnsignedByteArray; size = 1; break;
+  case 'h': type = v8::kExternalShortArray; size = 2; break;
+  case 'H': type = v8::kExternalUnsignedShortArray; size = 2; break;
+  case 'i':
+  case 'l': type = v8::kExternalIntArray; size = 4; break;
+  case 'I':
+  case 'L': type = v8::kExternalUnsignedIntArray; size = 4; break;
+  case 'f': type = v8::kExternalFloatArray; size = 4; break;
+  case 'd': type = v8::kExternalDoubleArray; size = 8; break;
+  default: return false;
+  }
+
+  return size == itemsize;
+}
+
+py::object *CPythonObject::GetBufferView(py::object obj, v8::ExternalArrayType& type)
+{
+  PyObject *view = ::PyMemoryView_FromObject(obj.ptr());
+
+  if (!view)
+  {
+    ::PyErr_Clear();
+
+    return NULL;
+  }
+
+  py::object *payload = new py::object(py::handle<>(view));
+
+  Py_buffer *buffer = PyMemoryView_GET_BUFFER(view);
+
+  if (buffer->readonly || buffer->ndim > 1 || !::PyBuffer_IsContiguous(buffer, 'C') ||
+      !GetExternalArrayType(buffer->format, buffer->itemsize, type) || 
+      buffer->len / buffer->itemsize > INT_MAX)
+  {
+    delete payload;
+
+    return NULL;
+  }
+
+  return payload;
+}
+
+CPythonObject::BufferViews& CPythonObject::GetBufferViews(void)
+{
+  static BufferViews s_views;
+
+  return s_views;
+}
+
+void CPythonObject::ReleaseBufferView(v8::Persistent<v8::Value> wrapper, void *parameter)
+{
+  wrapper.Dispose();
+
+  CPythonGIL python_gil;
+
+  py::object *view = static_cast<py::object *>(parameter);
+
+  // a released view has already been removed
+
+  if (view->ptr() != Py_None)
+  {
+    BufferViews& views = GetBufferViews();
+
+    std::pair<BufferViews::iterator, BufferViews::iterator> range = 
+      views.equal_range(PyMemoryView_GET_BUFFER(view->ptr())->obj);
+
+    for (BufferViews::iterator it = range.first; it != range.second; it++)
+    {
+      if (it->second == view)
+      {
+        views.erase(it);
+        break;
+      }
+    }
+  }
+
+  delete view;
+}
+
+bool CPythonObject::ReleaseBuffer(py::object obj)
+{
+  CLocker::CheckLocked();
+
+  v8::HandleScope handle_scope;
+
+  BufferViews& views = GetBufferViews();
+
+  std::pair<BufferViews::iterator, BufferViews::iterator> range = views.equal_range(obj.ptr());
+
+  if (range.first == range.second) return false;
+
+  // empty the JS wrappers before the memory goes away, and forget them, 
+  // so the buffer is exported again the next time it is passed to JS
+
+  ObjectCache& cache = GetObjectCache();
+
+  std::pair<ObjectCache::iterator, ObjectCache::iterator> wrappers = cache.equal_range(obj.ptr());
+
+  for (ObjectCache::iterator it = wrappers.first; it != wrappers.second; it++)
+  {
+    if (it->second->HasIndexedPropertiesInExternalArrayData())
+      it->second->SetIndexedPropertiesToExternalArrayData(NULL, it->second->GetIndexedPropertiesExternalArrayDataType(), 0);
+  }
+
+  cache.erase(wrappers.first, wrappers.second);
+
+  // the views are deleted by the weak callbacks of the wrappers, only release the buffer now
+
+  for (BufferViews::iterator it = range.first; it != range.second; it++)
+  {
+    *it->second = py::object();
+  }
+
+  views.erase(range.first, range.second);
+
+  return true;
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertObject(py::object obj)
+{
+  v8::Handle<v8::Object> cached = FindCachedObject(obj.ptr());
+
+  if (!cached.IsEmpty()) return cached;
+
+  // the writable buffers are exposed as external arrays, JS reads and writes their memory directly
+
+  v8::ExternalArrayType array_type = v8::kExternalUnsignedByteArray;
+
+  py::object *view = PyObject_CheckBuffer(obj.ptr()) ? GetBufferView(obj, array_type) : NULL;
+
+  static v8::Persistent<v8::ObjectTemplate> s_template = CreateObjectTemplate();
+  static v8::Persistent<v8::ObjectTemplate> s_buffer_template = CreateObjectTemplate(false);
+
+  // the instances of the Python classes with the default attribute lookup get the template of their class
+
+  PyTypeObject *type = Py_TYPE(obj.ptr());
+
+  v8::Handle<v8::Object> instance;
+
+  if (view)
+    instance = s_buffer_template->NewInstance();
+  else if (PyType_HasFeature(type, Py_TPFLAGS_HEAPTYPE) && type->tp_getattro == ::PyObject_GenericGetAttr)
+    instance = GetTypeTemplate(type)->GetFunction()->NewInstance();
+  else
+    instance = s_template->NewInstance();
+
+  AttachObject(obj, instance);
+
+  if (view)
+  {
+    Py_buffer *buffer = PyMemoryView_GET_BUFFER(view->ptr());
+
+    instance->SetIndexedPropertiesToExternalArrayData(buffer->buf, array_type, 
+      static_cast<int>(buffer->len / buffer->itemsize));
+
+    v8::Persistent<v8::Object>::New(instance).MakeWeak(view, ReleaseBufferView);
+
+    GetBufferViews().insert(std::make_pair(obj.ptr(), view));
+  }
+
+  return instance;
+}
+
+v8::Handle<v8::Value> CPythonObject::ConvertByPython(py::object obj)
+{
+  PythonConverters& py_converters = GetPythonConverters();
+
+  PythonConverters::const_iterator it = py_converters.find(Py_TYPE(obj.ptr()));
+
+  if (it == py_converters.end()) return WrapGeneric(obj);
+
+  py::object result = it->second.callable(obj);
+
+  // a converter returning the same type would loop forever
+  if (Py_TYPE(result.ptr()) == Py_TYPE(obj.ptr())) return WrapGeneric(result);
+
+  return Wrap(result);
+}
+
+v8::Handle<v8::Value> CPythonObject::Wrap(py::object obj)
+{
+  assert(v8::Context::InContext());
+
+  v8::HandleScope handle_scope;
+
+  Converters& converters = GetConverters();
+
+  Converters::const_iterator it = converters.find(Py_TYPE(obj.ptr()));
+
+  return handle_scope.Close(it != converters.end() ? it->second(obj) : WrapGeneric(obj));
+}
+
+v8::Handle<v8::Array> CPythonObject::WrapSequence(py::object seq)
+{
+  assert(v8::Context::InContext());
+
+  v8::HandleScope handle_scope;
+
+  py::object items(py::handle<>(::PySequence_Fast(seq.ptr(), "expected a sequence")));
+
+  Py_ssize_t size = PySequence_Fast_GET_SIZE(items.ptr());
+  PyObject **data = PySequence_Fast_ITEMS(items.ptr());
+
+  v8::Handle<v8::Array> array = v8::Array::New(size);
+
+  Converters& converters = GetConverters();
+
+  bool numeric = converters[&PyInt_Type] == ConvertInt && converters[&PyFloat_Type] == ConvertFloat;
+
+  for (Py_ssize_t i=0; numeric && i<size; i++)
+  {
+    numeric = PyInt_CheckExact(data[i]) || PyFloat_CheckExact(data[i]);
+  }
+
+  if (numeric)
+  {
+    for (Py_ssize_t i=0; i<size; i++)
+    {
+      if (PyFloat_CheckExact(data[i]))
+      {
+        array->Set(i, v8::Number::New(PyFloat_AS_DOUBLE(data[i])));
+      }
+      else
+      {
+        long value = PyInt_AS_LONG(data[i]);
+
+        if (static_cast<int32_t>(value) == value)
+          array->Set(i, v8::Integer::New(static_cast<int32_t>(value)));
+        else
+          array->Set(i, v8::Number::New(static_cast<double>(value)));
+      }
+    }
+  }
+  else
+  {
+    for (Py_ssize_t i=0; i<size; i++)
+    {
+      array->Set(i, Wrap(py::object(py::handle<>(py::borrowed(data[i])))));
+    }
+  }
+
+  return handle_scope.Close(array);
+}
+
+v8::Handle<v8::Value> CPythonObject::WrapGeneric(py::object obj)
+{
+  // the subclasses of the builtin types and the JS object wrappers
+
+  if (PyBool_Check(obj.ptr())) return ConvertBool(obj);
+  if (PyInt_Check(obj.ptr())) return ConvertInt(obj);
+  if (PyLong_Check(obj.ptr())) return ConvertLong(obj);
+  if (PyFloat_Check(obj.ptr())) return ConvertFloat(obj);
+  if (PyString_Check(obj.ptr())) return ConvertString(obj);
+  if (PyUnicode_Check(obj.ptr())) return ConvertUnicode(obj);
+
+  py::extract<CJavascriptObject&> extractor(obj);
+
+  if (extractor.check()) return extractor().Object();
+
+  if (PyFunction_Check(obj.ptr()) || PyMethod_Check(obj.ptr()) || PyType_Check(obj.ptr()))
+    return ConvertCallable(obj);
+
+  if (PyNumber_Check(obj.ptr()))
+    return v8::Number::New(py::extract<double>(obj));
+
+  return ConvertObject(obj);
+}
+
+void CJavascriptObject::CheckAttr(v8::Handle<v8::String> name) const
+{
+  assert(v8::Context::InContext());
+
+  if (!m_obj->Has(name))
+  {
+    std::ostringstream msg;
+      
+    msg << "'" << *v8::String::AsciiValue(m_obj->ObjectProtoToString()) 
+        << "' object has no attribute '" << *v8::String::AsciiValue(name) << "'";
+
+    throw CJavascriptException(msg.str(), ::PyExc_AttributeError);
+  }
+}
+
+CJavascriptObject::SymbolCache& CJavascriptObject::GetSymbolCache(void)
+{
+  static SymbolCache s_cache;
+
+  return s_cache;
+}
+
+v8::Handle<v8::String> CJavascriptObject::GetSymbol(py::object name)
+{
+  PyObject *str = name.ptr();
+
+  if (!PyString_CheckExact(str) || !PyString_CHECK_INTERNED(str)) 
+    return CPythonObject::WrapString(name);
+
+  SymbolCache& cache = GetSymbolCache();
+
+  SymbolCache::const_iterator it = cache.find(str);
+
+  if (it != cache.end()) return it->second;
+
+  if (cache.size() >= SYMBOL_CACHE_SIZE)
+  {
+    for (SymbolCache::iterator it = cache.begin(); it != cache.end(); it++)
+    {
+      it->second.Dispose();
+
+      Py_DECREF(it->first);
+    }
+
+    cache.clear();
+  }
+
+  v8::Persistent<v8::String> symbol = v8::Persistent<v8::String>::New(
+    v8::String::NewSymbol(PyString_AS_STRING(str), PyString_GET_SIZE(str)));
+
+  Py_INCREF(str);
+
+  cache[str] = symbol;
+
+  return symbol;
+}
+
+py::object CJavascriptObject::GetAttr(py::object name)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::String> attr_name = GetSymbol(name);
+
+  v8::Handle<v8::Value> attr_value = m_obj->Get(attr_name);
+
+  if (attr_value.IsEmpty()) 
+    CJavascriptException::ThrowIf(try_catch);
+
+  // one lookup for the present attributes, the undefined ones may be absent
+
+  if (attr_value->IsUndefined()) CheckAttr(attr_name);
+
+  return CJavascriptObject::Wrap(attr_value, m_obj);
+}
+
+void CJavascriptObject::SetAttr(py::object name, py::object value)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::String> attr_name = GetSymbol(name);
+  v8::Handle<v8::Value> attr_obj = CPythonObject::Wrap(value);
+
+  if (!m_obj->Set(attr_name, attr_obj)) 
+    CJavascriptException::ThrowIf(try_catch);
+}
+void CJavascriptObject::DelAttr(py::object name)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::String> attr_name = GetSymbol(name);
+
+  CheckAttr(attr_name);
+  
+  if (!m_obj->Delete(attr_name)) 
+    CJavascriptException::ThrowIf(try_catch);
+}
+py::list CJavascriptObject::GetAttrList(void)
+{
+  py::list attrs;
+
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Array> props = m_obj->GetPropertyNames();
+
+  for (size_t i=0; i<props->Length(); i++)
+  {    
+    attrs.append(CJavascriptObject::Wrap(props->Get(v8::Integer::New(i))));
+  }
+
+  if (try_catch.HasCaught()) CJavascriptException::ThrowIf(try_catch);
+
+  return attrs;
+}
+
+CJavascriptMapping::CJavascriptMapping(CJavascriptObjectPtr obj)
+{
+  v8::HandleScope handle_scope;
+
+  if (!obj->Object()->IsObject()) 
+    throw CJavascriptException("expect a javascript object", ::PyExc_TypeError);
+
+  m_obj = v8::Persistent<v8::Object>::New(obj->Object());
+}
+
+size_t CJavascriptMapping::Len(void)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Array> names = m_obj->GetPropertyNames();
+
+  if (names.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+
+  return names->Length();
+}
+
+py::object CJavascriptMapping::GetItem(py::object key)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Value> name = CPythonObject::Wrap(key);
+
+  v8::Handle<v8::Value> value = m_obj->Get(name);
+
+  if (value.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+
+  // one lookup for the present keys, the undefined values are checked again
+
+  if (value->IsUndefined() && !m_obj->Has(name->ToString()))
+  {
+    if (try_catch.HasCaught()) CJavascriptException::ThrowIf(try_catch);
+
+    throw CJavascriptException(py::extract<std::string>(py::str(key))(), ::PyExc_KeyError);
+  }
+
+  return CJavascriptObject::Wrap(value, m_obj);
+}
+
+bool CJavascriptMapping::Contains(py::object key)
+{
+  v8::HandleScope handle_scope;
+
+  if (PyInt_Check(key.ptr()) && PyInt_AS_LONG(key.ptr()) >= 0)
+    return m_obj->Has(static_cast<uint32_t>(PyInt_AS_LONG(key.ptr())));
+
+  if (PyString_Check(key.ptr()) || PyUnicode_Check(key.ptr()))
+    return m_obj->Has(CPythonObject::WrapString(key));
+
+  return false;
+}
+
+CJavascriptObjectIteratorPtr CJavascriptMapping::IterKeys(void)
+{
+  return CJavascriptObjectIteratorPtr(new CJavascriptObjectIterator(m_obj, CJavascriptObjectIterator::KEYS));
+}
+
+CJavascriptObjectIteratorPtr CJavascriptMapping::IterValues(void)
+{
+  return CJavascriptObjectIteratorPtr(new CJavascriptObjectIterator(m_obj, CJavascriptObjectIterator::VALUES));
+}
+
+CJavascriptObjectIteratorPtr CJavascriptMapping::IterItems(void)
+{
+  return CJavascriptObjectIteratorPtr(new CJavascriptObjectIterator(m_obj, CJavascriptObjectIterator::ITEMS));
+}
+
+py::list CJavascriptMapping::Keys(void)
+{
+  return py::list(py::object(IterKeys()));
+}
+
+py::list CJavascriptMapping::Values(void)
+{
+  return py::list(py::object(IterValues()));
+}
+
+py::list CJavascriptMapping::Items(void)
+{
+  return py::list(py::object(IterItems()));
+}
+
+CJavascriptObjectIterator::CJavascriptObjectIterator(v8::Handle<v8::Object> obj, Kind kind)
+  : m_kind(kind), m_idx(0)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Array> names = obj->GetPropertyNames();
+
+  if (names.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+
+  m_obj = v8::Persistent<v8::Object>::New(obj);
+  m_names = v8::Persistent<v8::Array>::New(names);
+}
+
+void CJavascriptObjectIterator::Prefetch(void)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  uint32_t end = std::min(m_idx + CHUNK_SIZE, m_names->Length());
+
+  for (; m_idx < end; m_idx++)
+  {
+    v8::Handle<v8::Value> name = m_names->Get(m_idx);
+
+    if (m_kind == KEYS)
+    {
+      m_chunk.push_back(CJavascriptObject::Wrap(name));
+
+      continue;
+    }
+
+    v8::Handle<v8::Value> value = m_obj->Get(name);
+
+    if (value.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+
+    py::object item = CJavascriptObject::Wrap(value, m_obj);
+
+    m_chunk.push_back(m_kind == VALUES ? item : py::make_tuple(CJavascriptObject::Wrap(name), item));
+  }
+}
+
+py::object CJavascriptObjectIterator::Next(void)
+{
+  if (m_chunk.empty()) Prefetch();
+
+  if (m_chunk.empty())
+  {
+    ::PyErr_SetNone(::PyExc_StopIteration);
+
+    py::throw_error_already_set();
+  }
+
+  py::object item = m_chunk.front();
+
+  m_chunk.pop_front();
+
+  return item;
+}
+
+py::object CJavascriptObject::ToPython(bool deep, int max_depth)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  ConvertedObjects converted;
+
+  py::object result = Convert(m_obj, v8::Handle<v8::Object>(), deep ? max_depth : 1, converted);
+
+  if (try_catch.HasCaught()) CJavascriptException::ThrowIf(try_catch);
+
+  return result;
+}
+
+py::object CJavascriptObject::Convert(v8::Handle<v8::Value> value, v8::Handle<v8::Object> self, 
+                                      int depth, ConvertedObjects& converted)
+{
+  if (value.IsEmpty() || !value->IsObject() || depth <= 0) return Wrap(value, self);
+
+  // the handles of a node are released with it, the converted objects keep their own
+
+  v8::HandleScope handle_scope;
+
+  v8::Handle<v8::Object> obj = value->ToObject();
+
+  if (obj->IsFunction() || obj->IsDate() || obj->IsRegExp() || obj->InternalFieldCount() > 0)
+    return Wrap(obj, self);
+
+  if (obj->IsArray())
+  {
+    v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(obj);
+
+    uint32_t size = array->Length();
+
+    PyObject *found = converted.Find(obj, (size << 1) | 1);
+
+    if (found) return py::object(py::handle<>(py::borrowed(found)));
+
+    py::list items(py::handle<>(::PyList_New(size)));
+
+    converted.Insert(obj, (size << 1) | 1, items.ptr());
+
+    for (uint32_t i=0; i<size; i++)
+    {
+      v8::Handle<v8::Value> item = array->Get(i);
+
+      if (item.IsEmpty()) break;
+
+      PyList_SET_ITEM(items.ptr(), i, py::incref(Convert(item, obj, depth-1, converted).ptr()));
+    }
+
+    return items;
+  }
+
+  v8::Handle<v8::Array> names = obj->GetPropertyNames();
+
+  if (names.IsEmpty()) return py::dict();
+
+  PyObject *found = converted.Find(obj, names->Length() << 1);
+
+  if (found) return py::object(py::handle<>(py::borrowed(found)));
+
+  py::dict attrs;
+
+  converted.Insert(obj, names->Length() << 1, attrs.ptr());
+
+  for (uint32_t i=0; i<names->Length(); i++)
+  {
+    v8::Handle<v8::Value> name = names->Get(i);
+    v8::Handle<v8::Value> item = name.IsEmpty() ? name : obj->Get(name);
+
+    if (item.IsEmpty()) break;
+
+    attrs[WrapString(name->ToString())] = Convert(item, obj, depth-1, converted);
+  }
+
+  return attrs;
+}
+
+CJavascriptObject::ConvertedObjects::~ConvertedObjects()
+{
+  for (std::map<uint32_t, Bucket>::iterator it = m_buckets.begin(); it != m_buckets.end(); it++)
+  {
+    for (Objects::iterator obj = it->second.objects.begin(); obj != it->second.objects.end(); obj++)
+    {
+      obj->first.Dispose();
+    }
+  }
+}
+
+PyObject *CJavascriptObject::ConvertedObjects::Find(v8::Handle<v8::Object> obj, uint32_t shape)
+{
+  std::map<uint32_t, Bucket>::iterator it = m_buckets.find(shape);
+
+  if (it == m_buckets.end()) return NULL;
+
+  Bucket& bucket = it->second;
+
+  if (bucket.hashed)
+  {
+    std::pair<std::multimap<int, size_t>::iterator, std::multimap<int, size_t>::iterator> range = 
+      bucket.index.equal_range(obj->GetIdentityHash());
+
+    for (std::multimap<int, size_t>::iterator idx = range.first; idx != range.second; idx++)
+    {
+      if (bucket.objects[idx->second].first == obj) return bucket.objects[idx->second].second;
+    }
+  }
+  else
+  {
+    for (Objects::iterator idx = bucket.objects.begin(); idx != bucket.objects.end(); idx++)
+    {
+      if (idx->first == obj) return idx->second;
+    }
+  }
+
+  return NULL;
+}
+
+void CJavascriptObject::ConvertedObjects::Insert(v8::Handle<v8::Object> obj, uint32_t shape, PyObject *converted)
+{
+  Bucket& bucket = m_buckets[shape];
+
+  bucket.objects.push_back(std::make_pair(v8::Persistent<v8::Object>::New(obj), converted));
+
+  if (!bucket.hashed && bucket.objects.size() > HASHED_BUCKET_SIZE)
+  {
+    // too many objects of the same shape to compare them one by one
+
+    for (size_t i=0; i<bucket.objects.size(); i++)
+    {
+      bucket.index.insert(std::make_pair(bucket.objects[i].first->GetIdentityHash(), i));
+    }
+
+    bucket.hashed = true;
+  }
+  else if (bucket.hashed)
+  {
+    bucket.index.insert(std::make_pair(obj->GetIdentityHash(), bucket.objects.size() - 1));
+  }
+}
+
+bool CJavascriptObject::Equals(CJavascriptObjectPtr other) const
+{
+  v8::HandleScope handle_scope;
+
+  return m_obj->Equals(other->m_obj);
+}
+
+void CJavascriptObject::Dump(std::ostream& os) const
+{
+  v8::HandleScope handle_scope;
+
+  if (m_obj.IsEmpty())
+    os << "None";
+  else if (m_obj->IsInt32())
+    os << m_obj->Int32Value();
+  else if (m_obj->IsNumber())
+    os << m_obj->NumberValue();
+  else if (m_obj->IsBoolean())
+    os << m_obj->BooleanValue();
+  else if (m_obj->IsNull())
+    os << "None";
+  else if (m_obj->IsUndefined())
+    os << "N/A";
+  else if (m_obj->IsString())  
+    os << *v8::String::AsciiValue(v8::Handle<v8::String>::Cast(m_obj));  
+  else 
+    os << *v8::String::AsciiValue(m_obj->ToString());
+}
+
+CJavascriptObject::operator long() const 
+{ 
+  v8::HandleScope handle_scope;
+
+  if (m_obj.IsEmpty())
+    throw CJavascriptException("argument must be a string or a number, not 'NoneType'", ::PyExc_TypeError);
+
+  return m_obj->Int32Value(); 
+}
+CJavascriptObject::operator double() const 
+{ 
+  v8::HandleScope handle_scope;
+
+  if (m_obj.IsEmpty())
+    throw CJavascriptException("argument must be a string or a number, not 'NoneType'", ::PyExc_TypeError);
+
+  return m_obj->NumberValue(); 
+}
+
+CJavascriptObject::operator bool() const
+{
+  v8::HandleScope handle_scope;
+
+  if (m_obj.IsEmpty()) return false;
+
+  return m_obj->BooleanValue();
+}
+
+py::object CJavascriptObject::Wrap(v8::Handle<v8::Value> value, v8::Handle<v8::Object> self)
+{
+  assert(v8::Context::InContext());
+
+  v8::HandleScope handle_scope;
+
+  if (value.IsEmpty() || value->IsNull()) return py::object(py::handle<>(Py_None));
+  if (value->IsTrue()) return py::object(py::handle<>(Py_True));
+  if (value->IsFalse()) return py::object(py::handle<>(Py_False));
+
+  if (value->IsInt32()) return py::object(value->Int32Value());  
+  if (value->IsString()) return WrapString(v8::Handle<v8::String>::Cast(value));
+  if (value->IsBoolean()) return py::object(py::handle<>(value->BooleanValue() ? Py_True : Py_False));
+  if (value->IsNumber()) return py::object(py::handle<>(::PyFloat_FromDouble(value->NumberValue())));
+
+  return Wrap(value->ToObject(), self);
+}
+
+py::object CJavascriptObject::WrapString(v8::Handle<v8::String> str)
+{
+  // written once straight into the Python object, ASCII as a str and the others as unicode
+
+  int len = str->Length();
+
+  if (!str->MayContainNonAscii())
+  {
+    py::object result(py::handle<>(::PyString_FromStringAndSize(NULL, len)));
+
+    str->WriteAscii(PyString_AS_STRING(result.ptr()), 0, len, v8::String::NO_NULL_TERMINATION);
+
+    return result;
+  }
+
+#if Py_UNICODE_SIZE == 2
+  py::object result(py::handle<>(::PyUnicode_FromUnicode(NULL, len)));
+
+  uint16_t *buf = reinterpret_cast<uint16_t *>(PyUnicode_AS_UNICODE(result.ptr()));
+
+  str->Write(buf, 0, len, v8::String::NO_NULL_TERMINATION);
+
+  if (!IsAscii(buf, len)) return result;
+#else
+  uint16_t stack_buf[256];
+  std::vector<uint16_t> heap_buf;
+
+  if (len > 256) heap_buf.resize(len);
+
+  uint16_t *buf = len > 256 ? &heap_buf[0] : stack_buf;
+
+  str->Write(buf, 0, len, v8::String::NO_NULL_TERMINATION);
+
+  if (!IsAscii(buf, len))
+  {
+    // UCS4 build, join the UTF-16 surrogate pairs into the code points above BMP
+
+    int pairs = 0;
+
+    for (int i=0; i+1<len; i++)
+    {
+      if ((buf[i] & 0xFC00) == 0xD800 && (buf[i+1] & 0xFC00) == 0xDC00) 
+      {
+        pairs++;
+        i++;
+      }
+    }
+
+    py::object result(py::handle<>(::PyUnicode_FromUnicode(NULL, len - pairs)));
+
+    Py_UNICODE *dst = PyUnicode_AS_UNICODE(result.ptr());
+
+    for (int i=0; i<len; i++)
+    {
+      if (i+1 < len && (buf[i] & 0xFC00) == 0xD800 && (buf[i+1] & 0xFC00) == 0xDC00)
+      {
+        *dst++ = 0x10000 + ((buf[i] - 0xD800) << 10) + (buf[i+1] - 0xDC00);
+        i++;
+      }
+      else
+      {
+        *dst++ = buf[i];
+      }
+    }
+
+    return result;
+  }
+#endif
+
+  // V8 can't always tell an ASCII string, narrow it to a str
+
+  py::object ascii(py::handle<>(::PyString_FromStringAndSize(NULL, len)));
+
+  char *dst = PyString_AS_STRING(ascii.ptr());
+
+  for (int i=0; i<len; i++) dst[i] = static_cast<char>(buf[i]);
+
+  return ascii;
+}
+
+py::object CJavascriptObject::Wrap(v8::Handle<v8::Object> obj, v8::Handle<v8::Object> self) 
+{
+  v8::HandleScope handle_scope;
+
+  if (obj.IsEmpty())
+  {
+    return py::object(py::handle<>(Py_None));
+  }
+  else if (obj->IsArray())
+  {
+    v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(obj);
+
+    int hash = array->GetIdentityHash();
+
+    py::object cached = FindCachedWrapper(hash, array, self);
+
+    return cached.ptr() != Py_None ? cached : CacheWrapper(hash, new CJavascriptArray(array));
+  }
+  else if (obj->IsFunction())
+  {
+    v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(obj);
+
+    if (func->InternalFieldCount() == 1)
+    {
+      v8::Handle<v8::External> field = v8::Handle<v8::External>::Cast(func->GetInternalField(0));
+
+      return *static_cast<py::object *>(field->Value());
+    }
+
+    int hash = func->GetIdentityHash();
+
+    py::object cached = FindCachedWrapper(hash, func, self);
+
+    return cached.ptr() != Py_None ? cached : CacheWrapper(hash, new CJavascriptFunction(self, func));
+  }
+  else if (obj->IsObject() && obj->InternalFieldCount() == 1)
+  {
+    v8::Handle<v8::External> field = v8::Handle<v8::External>::Cast(obj->GetInternalField(0));
+
+    return *static_cast<py::object *>(field->Value());   
+  }
+
+  int hash = obj->GetIdentityHash();
+
+  py::object cached = FindCachedWrapper(hash, obj, self);
+
+  return cached.ptr() != Py_None ? cached : CacheWrapper(hash, new CJavascriptObject(obj));
+}
+
+CJavascriptObject::WrapperCache& CJavascriptObject::GetWrapperCache(void)
+{
+  static WrapperCache s_cache;
+
+  return s_cache;
+}
+
+py::object CJavascriptObject::FindCachedWrapper(int hash, v8::Handle<v8::Object> obj, v8::Handle<v8::Object> self)
+{
+  WrapperCache& cache = GetWrapperCache();
+
+  std::pair<WrapperCache::iterator, WrapperCache::iterator> range = cache.equal_range(hash);
+
+  WrapperCache::iterator it = range.first;
+
+  while (it != range.second)
+  {
+    PyObject *wrapper = PyWeakref_GET_OBJECT(it->second);
+
+    if (wrapper == Py_None)
+    {
+      // the wrapper has been released, prune the stale weakref
+
+      Py_DECREF(it->second);
+
+      cache.erase(it++);
+
+      continue;
+    }
+
+    CJavascriptObject& cached = py::extract<CJavascriptObject&>(wrapper);
+
+    if (cached.Object() == obj)
+    {
+      // the functions are bound to their owner as well
+
+      CJavascriptFunction *func = dynamic_cast<CJavascriptFunction *>(&cached);
+
+      if (!func || func->Self() == self)
+        return py::object(py::handle<>(py::borrowed(wrapper)));
+    }
+
+    it++;
+  }
+
+  return py::object();
+}
+
+py::object CJavascriptObject::CacheWrapper(int hash, CJavascriptObject *wrapper)
+{
+  py::object obj = Wrap(wrapper);
+
+  PyObject *ref = ::PyWeakref_NewRef(obj.ptr(), NULL);
+
+  if (!ref)
+  {
+    // the wrapper still works, the next crossing of the object just wraps it again
+
+    ::PyErr_Clear();
+
+    return obj;
+  }
+
+  WrapperCache& cache = GetWrapperCache();
+
+  cache.insert(std::make_pair(hash, ref));
+
+  SweepWrapperCache();
+
+  return obj;
+}
+
+void CJavascriptObject::SweepWrapperCache(void)
+{
+  // prune the stale weakrefs when the cache doubles, amortized O(1) per wrapper
+
+  static size_t s_threshold = 1024;
+
+  WrapperCache& cache = GetWrapperCache();
+
+  if (cache.size() < s_threshold) return;
+
+  for (WrapperCache::iterator it = cache.begin(); it != cache.end(); )
   {
-    array->Set(v8::Integer::New(i), CPythonObject::Wrap(items[i]));
+    if (PyWeakref_GET_OBJECT(it->second) == Py_None)
+    {
+      Py_DECREF(it->second);
+
+      cache.erase(it++);
+    }
+    else
+    {
+      it++;
+    }
   }
 
+  s_threshold = std::max<size_t>(1024, cache.size() * 2);
+}
+
+py::object CJavascriptObject::Wrap(CJavascriptObject *obj)
+{
+  return py::object(py::handle<>(boost::python::converter::shared_ptr_to_python<CJavascriptObject>(CJavascriptObjectPtr(obj))));
+}
+
+CJavascriptArray::CJavascriptArray(size_t size)  
+{
+  v8::HandleScope handle_scope;
+
+  v8::Handle<v8::Array> array = v8::Array::New(size);
+
   m_obj = v8::Persistent<v8::Object>::New(array);  
 }
+CJavascriptArray::CJavascriptArray(py::list items)
+{
+  v8::HandleScope handle_scope;
+
+  m_obj = v8::Persistent<v8::Object>::New(CPythonObject::WrapSequence(items));  
+}
+py::object CJavascriptArray::FromSequence(py::object seq)
+{
+  v8::HandleScope handle_scope;
+
+  return Wrap(new CJavascriptArray(CPythonObject::WrapSequence(seq)));
+}
 size_t CJavascriptArray::Length(void) const
 {
   v8::HandleScope handle_scope;
@@ -650,6 +2445,68 @@ py::object CJavascriptArray::GetItem(size_t idx)
 
   return CJavascriptObject::Wrap(value, m_obj);
 }
+static PyObject *WrapItem(v8::Handle<v8::Value> value, v8::Handle<v8::Object> self)
+{
+  // the numbers are the common case of the big arrays
+
+  if (value->IsInt32()) return ::PyInt_FromLong(value->Int32Value());
+  if (value->IsNumber()) return ::PyFloat_FromDouble(value->NumberValue());
+
+  return py::incref(CJavascriptObject::Wrap(value, self).ptr());
+}
+py::list CJavascriptArray::GetSlice(py::slice slice)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  Py_ssize_t start, stop, step, count;
+
+  if (0 > ::PySlice_GetIndicesEx(reinterpret_cast<PySliceObject *>(slice.ptr()), Length(), &start, &stop, &step, &count))
+    py::throw_error_already_set();
+
+  py::list items(py::handle<>(::PyList_New(count)));
+
+  for (Py_ssize_t i=0, idx=start; i<count; i++, idx+=step)
+  {
+    v8::HandleScope item_scope;
+
+    v8::Handle<v8::Value> value = m_obj->Get(static_cast<uint32_t>(idx));
+
+    if (value.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+
+    PyList_SET_ITEM(items.ptr(), i, WrapItem(value, m_obj));
+  }
+
+  return items;
+}
+py::list CJavascriptArray::ToList(void)
+{
+  v8::HandleScope handle_scope;
+
+  v8::TryCatch try_catch;
+
+  uint32_t size = v8::Handle<v8::Array>::Cast(m_obj)->Length();
+
+  py::list items(py::handle<>(::PyList_New(size)));
+
+  for (uint32_t i=0; i<size; i++)
+  {
+    v8::HandleScope item_scope;
+
+    v8::Handle<v8::Value> value = m_obj->Get(i);
+
+    if (value.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+
+    PyList_SET_ITEM(items.ptr(), i, WrapItem(value, m_obj));
+  }
+
+  return items;
+}
+py::object CJavascriptArray::Iter(void)
+{
+  return py::object(py::handle<>(::PyObject_GetIter(ToList().ptr())));
+}
 py::object CJavascriptArray::SetItem(size_t idx, py::object value)
 {
   v8::HandleScope handle_scope;
@@ -712,13 +2569,25 @@ py::object CJavascriptFunction::Call(v8::Handle<v8::Object> self, py::list args,
     params[i] = CPythonObject::Wrap(args[i]);
   }
 
-  v8::Handle<v8::Value> result = func->Call(
-    self.IsEmpty() ? v8::Context::GetCurrent()->Global() : self,
-    params.size(), params.empty() ? NULL : &params[0]);
+  v8::Handle<v8::Value> result;
+
+  CExecutionScope execution_scope;
+
+  {
+    CPythonAllowThreads python_threads;
+
+    result = func->Call(self.IsEmpty() ? v8::Context::GetCurrent()->Global() : self,
+                        params.size(), params.empty() ? NULL : &params[0]);
+  }
+
+  if (result.IsEmpty())
+  {
+    CResourceLimits::ThrowIf(try_catch);
 
-  if (result.IsEmpty()) CJavascriptException::ThrowIf(try_catch);
+    CJavascriptException::ThrowIf(try_catch);
+  }
 
-  return CJavascriptObject::Wrap(result->ToObject());
+  return CJavascriptObject::Wrap(result);
 }
 py::object CJavascriptFunction::Apply(CJavascriptObjectPtr self, py::list args, py::dict kwds)
 {
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <sstream>
+#include <map>
+#include <deque>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/iterator/iterator_facade.hpp>
@@ -8,8 +11,10 @@
 #include "Exception.h"
 
 class CJavascriptObject;
+class CJavascriptObjectIterator;
 
 typedef boost::shared_ptr<CJavascriptObject> CJavascriptObjectPtr;
+typedef boost::shared_ptr<CJavascriptObjectIterator> CJavascriptObjectIteratorPtr;
 
 struct CWrapper
 {  
@@ -18,6 +23,70 @@ struct CWrapper
 
 class CPythonObject : public CWrapper
 {
+public:
+  typedef v8::Handle<v8::Value> (*Converter)(py::object obj);
+private:
+  // converters dispatched on the exact type of the Python object,
+  // the subclasses fall back to the generic conversion
+
+  typedef std::map<PyTypeObject *, Converter> Converters;
+
+  struct CPythonConverter
+  {
+    py::object callable;
+    Converter previous;
+  };
+
+  typedef std::map<PyTypeObject *, CPythonConverter> PythonConverters;
+
+  static Converters& GetConverters(void);
+  static PythonConverters& GetPythonConverters(void);
+
+  // the JS wrappers of the Python objects, so the same Python object is exposed 
+  // as the same JS object as long as the wrapper is alive in its context
+
+  typedef std::multimap<PyObject *, v8::Persistent<v8::Object> > ObjectCache;
+
+  static ObjectCache& GetObjectCache(void);
+
+  static size_t s_alive_wrappers, s_released_wrappers;
+
+  static v8::Handle<v8::Object> FindCachedObject(PyObject *obj);
+
+  // the wrapper is weak, the payload is released when V8 collects the wrapper
+  static void CacheObject(py::object *payload, v8::Handle<v8::Object> wrapper);
+  static void DisposeCachedObject(v8::Persistent<v8::Value> wrapper, void *parameter);
+
+  static v8::Handle<v8::Value> ConvertNone(py::object obj);
+  static v8::Handle<v8::Value> ConvertBool(py::object obj);
+  static v8::Handle<v8::Value> ConvertInt(py::object obj);
+  static v8::Handle<v8::Value> ConvertLong(py::object obj);
+  static v8::Handle<v8::Value> ConvertFloat(py::object obj);
+  static v8::Handle<v8::Value> ConvertString(py::object obj);
+  static v8::Handle<v8::Value> ConvertUnicode(py::object obj);
+  static v8::Handle<v8::Value> ConvertCallable(py::object obj);
+  static v8::Handle<v8::Value> ConvertDict(py::object obj);
+  static v8::Handle<v8::Value> ConvertSequence(py::object obj);
+  static v8::Handle<v8::Value> ConvertObject(py::object obj);
+  static v8::Handle<v8::Value> ConvertByPython(py::object obj);
+
+  static v8::Handle<v8::Value> WrapGeneric(py::object obj);
+
+  // a memoryview of a writable buffer to be exposed as an external array, or NULL,
+  // the view keeps the buffer exported so the memory can't be resized or freed
+  static py::object *GetBufferView(py::object obj, v8::ExternalArrayType& type);
+  static void ReleaseBufferView(v8::Persistent<v8::Value> wrapper, void *parameter);
+
+  // the views of the exported buffers, keyed by the buffer object, until 
+  // V8 collects their wrappers or the buffers are released by ReleaseBuffer
+
+  typedef std::multimap<PyObject *, py::object *> BufferViews;
+
+  static BufferViews& GetBufferViews(void);
+
+  // the shorter strings are cheaper to copy than to finalize
+  static const Py_ssize_t EXTERNAL_STRING_THRESHOLD = 4096;
+
   static void ThrowIf(void);
 
   static v8::Handle<v8::Value> NamedGetter(
@@ -38,12 +107,85 @@ class CPythonObject : public CWrapper
   static v8::Handle<v8::Boolean> IndexedDeleter(
     uint32_t index, const v8::AccessorInfo& info);
 
+  // the dicts are exposed as mappings of their keys, the lists and tuples by their items
+
+  static v8::Persistent<v8::ObjectTemplate> CreateDictTemplate(void);
+  static v8::Persistent<v8::ObjectTemplate> CreateSequenceTemplate(void);
+
+  static v8::Handle<v8::Value> DictGetter(
+    v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> DictSetter(
+    v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Integer> DictQuery(
+    v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Boolean> DictDeleter(
+    v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Array> DictEnumerator(const v8::AccessorInfo& info);
+
+  static v8::Handle<v8::Value> DictIndexedGetter(
+    uint32_t index, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> DictIndexedSetter(
+    uint32_t index, v8::Local<v8::Value> value, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Integer> DictIndexedQuery(
+    uint32_t index, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Boolean> DictIndexedDeleter(
+    uint32_t index, const v8::AccessorInfo& info);
+
+  static v8::Handle<v8::Value> SequenceGetter(
+    uint32_t index, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> SequenceSetter(
+    uint32_t index, v8::Local<v8::Value> value, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Integer> SequenceQuery(
+    uint32_t index, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Boolean> SequenceDeleter(
+    uint32_t index, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Array> SequenceEnumerator(const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> SequenceLength(
+    v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+
+  // the payload of the new wrapper, which is cached as the JS object of obj
+  static v8::Handle<v8::Object> AttachObject(py::object obj, v8::Handle<v8::Object> instance);
+
   static v8::Handle<v8::Value> Caller(const v8::Arguments& args);
+  static v8::Handle<v8::Value> Call(py::object callable, const v8::Arguments& args);
+
+  // the templates of the Python classes, with the methods on the prototype and the other
+  // class members as accessors, only the instance attributes are left to the interceptors
+
+  // keyed by the type with a weakref, which releases the template when the type is freed
+
+  typedef std::map<PyTypeObject *, std::pair<v8::Persistent<v8::FunctionTemplate>, PyObject *> > TypeTemplates;
+
+  static TypeTemplates& GetTypeTemplates(void);
+  static std::vector< v8::Persistent<v8::FunctionTemplate> >& GetReleasedTypeTemplates(void);
+  static void ReleaseTypeTemplate(py::object ref);
+  static v8::Handle<v8::FunctionTemplate> GetTypeTemplate(PyTypeObject *type);
+
+  static v8::Handle<v8::Value> InstanceGetter(
+    v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> MemberGetter(
+    v8::Local<v8::String> prop, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> MethodCaller(const v8::Arguments& args);
 protected:
-  static void SetupObjectTemplate(v8::Handle<v8::ObjectTemplate> clazz);
-  static v8::Persistent<v8::ObjectTemplate> CreateObjectTemplate(void);
+  static void SetupObjectTemplate(v8::Handle<v8::ObjectTemplate> clazz, bool indexed = true);
+  static v8::Persistent<v8::ObjectTemplate> CreateObjectTemplate(bool indexed = true);
 public:
   static v8::Handle<v8::Value> Wrap(py::object obj);
+  static v8::Handle<v8::String> WrapString(py::object obj);
+
+  // the whole sequence in one loop, the int and float items without the converters
+  static v8::Handle<v8::Array> WrapSequence(py::object seq);
+
+  static py::dict GetWrapperStatistics(void);
+
+  // detach the buffer from its JS wrappers, which become empty, so Python could resize it again
+  static bool ReleaseBuffer(py::object obj);
+
+  static void RegisterConverter(PyTypeObject *type, Converter converter);
+
+  // convert the instances of type with converter(obj), 
+  // the result is converted again; None to remove the converter
+  static void RegisterPythonConverter(py::object type, py::object converter);
 };
 
 class CJavascriptObject : public CWrapper
@@ -53,8 +195,61 @@ protected:
 
   void CheckAttr(v8::Handle<v8::String> name) const;
 
+  // the symbols of the interned Python attribute names, the names are referenced
+  // by the cache so their addresses can't be reused
+
+  typedef std::map<PyObject *, v8::Persistent<v8::String> > SymbolCache;
+
+  static SymbolCache& GetSymbolCache(void);
+
+  static const size_t SYMBOL_CACHE_SIZE = 4096;
+
+  static v8::Handle<v8::String> GetSymbol(py::object name);
+
   static py::object Wrap(CJavascriptObject *obj);
 
+  // the Python wrappers of the JS objects, weakrefs keyed by the identity hash
+  // of the JS object, so the same JS object is surfaced as the same wrapper
+
+  typedef std::multimap<int, PyObject *> WrapperCache;
+
+  static WrapperCache& GetWrapperCache(void);
+
+  static py::object FindCachedWrapper(int hash, v8::Handle<v8::Object> obj, v8::Handle<v8::Object> self);
+  static py::object CacheWrapper(int hash, CJavascriptObject *wrapper);
+  static void SweepWrapperCache(void);
+
+  // the JS objects already converted by to_py, so the cycles and the shared references 
+  // convert to the same Python objects. The objects are compared by handle within the 
+  // buckets of the same shape, only the crowded buckets are indexed by the identity hash,
+  // which V8 allocates as a hidden property of the object on the first call
+
+  class ConvertedObjects
+  {
+    static const size_t HASHED_BUCKET_SIZE = 16;
+
+    typedef std::vector< std::pair<v8::Persistent<v8::Object>, PyObject *> > Objects;
+
+    struct Bucket
+    {
+      Objects objects;
+      bool hashed;
+      std::multimap<int, size_t> index;
+
+      Bucket() : hashed(false) {}
+    };
+
+    std::map<uint32_t, Bucket> m_buckets;
+  public:
+    ~ConvertedObjects();
+
+    PyObject *Find(v8::Handle<v8::Object> obj, uint32_t shape);
+    void Insert(v8::Handle<v8::Object> obj, uint32_t shape, PyObject *converted);
+  };
+
+  static py::object Convert(v8::Handle<v8::Value> value, v8::Handle<v8::Object> self, 
+                            int depth, ConvertedObjects& converted);
+
   CJavascriptObject()
   {
 
@@ -73,11 +268,14 @@ public:
   v8::Handle<v8::Object> Object(void) { return m_obj; }
   long Native(void) { return reinterpret_cast<long>(*m_obj); }
 
-  py::object GetAttr(const std::string& name);
-  void SetAttr(const std::string& name, py::object value);
-  void DelAttr(const std::string& name);
+  py::object GetAttr(py::object name);
+  void SetAttr(py::object name, py::object value);
+  void DelAttr(py::object name);
 
   py::list GetAttrList(void);
+
+  // the arrays as lists and the plain objects as dicts, down to max_depth levels
+  py::object ToPython(bool deep, int max_depth);
   
   operator long() const;
   operator double() const;
@@ -88,6 +286,7 @@ public:
   
   void Dump(std::ostream& os) const;  
 
+  static py::object WrapString(v8::Handle<v8::String> str);
   static py::object Wrap(v8::Handle<v8::Value> value,
     v8::Handle<v8::Object> self = v8::Handle<v8::Object>());
   static py::object Wrap(v8::Handle<v8::Object> obj, 
@@ -97,24 +296,6 @@ public:
 class CJavascriptArray : public CJavascriptObject
 {
 public:
-  class ArrayIterator 
-    : public boost::iterator_facade<ArrayIterator, py::object const, boost::forward_traversal_tag>
-  {
-    CJavascriptArray *m_array;
-    size_t m_idx;
-  public:
-    ArrayIterator(CJavascriptArray *array, size_t idx)
-      : m_array(array), m_idx(idx)
-    {
-    }
-
-    void increment() { m_idx++; }
-
-    bool equal(ArrayIterator const& other) const { return m_array == other.m_array && m_idx == other.m_idx; }
-
-    reference dereference() const { return m_array->GetItem(m_idx); }
-  };
-
   CJavascriptArray(v8::Handle<v8::Array> array)
     : CJavascriptObject(array)
   {
@@ -127,12 +308,15 @@ public:
   size_t Length(void) const;
 
   py::object GetItem(size_t idx);
+  py::list GetSlice(py::slice slice);
   py::object SetItem(size_t idx, py::object value);
   py::object DelItem(size_t idx);
   bool Contains(py::object item);
 
-  ArrayIterator begin(void) { return ArrayIterator(this, 0);}
-  ArrayIterator end(void) { return ArrayIterator(this, Length());}
+  py::list ToList(void);
+  py::object Iter(void);
+
+  static py::object FromSequence(py::object seq);
 };
 
 class CJavascriptFunction : public CJavascriptObject
@@ -156,4 +340,61 @@ public:
 
   const std::string GetName(void) const;
   py::object GetOwner(void) const { return CJavascriptObject::Wrap(m_self); }
+
+  v8::Handle<v8::Object> Self(void) const { return m_self; }
+};
+
+// the mapping protocol over the enumerable properties of a JS object, as a separate view,
+// so the Python methods don't shadow the JS properties of the same names
+
+class CJavascriptMapping
+{
+  v8::Persistent<v8::Object> m_obj;
+public:
+  CJavascriptMapping(CJavascriptObjectPtr obj);
+  ~CJavascriptMapping()
+  {
+    m_obj.Dispose();
+  }
+
+  size_t Len(void);
+  py::object GetItem(py::object key);
+  bool Contains(py::object key);
+
+  CJavascriptObjectIteratorPtr IterKeys(void);
+  CJavascriptObjectIteratorPtr IterValues(void);
+  CJavascriptObjectIteratorPtr IterItems(void);
+
+  py::list Keys(void);
+  py::list Values(void);
+  py::list Items(void);
+};
+
+class CJavascriptObjectIterator
+{
+public:
+  enum Kind { KEYS, VALUES, ITEMS };
+private:
+  v8::Persistent<v8::Object> m_obj;
+  v8::Persistent<v8::Array> m_names;
+  Kind m_kind;
+  uint32_t m_idx;
+
+  // the items are converted a chunk at a time, a large object is never materialized at once
+  std::deque<py::object> m_chunk;
+
+  static const uint32_t CHUNK_SIZE = 64;
+
+  void Prefetch(void);
+public:
+  CJavascriptObjectIterator(v8::Handle<v8::Object> obj, Kind kind);
+  ~CJavascriptObjectIterator()
+  {
+    m_obj.Dispose();
+    m_names.Dispose();
+  }
+
+  py::object Next(void);
+
+  static py::object Iter(py::object self) { return self; }
 };